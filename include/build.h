@@ -1,44 +1,132 @@
 #ifndef BUILD_H
 #define BUILD_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "point.h"
 #include "position.h"
 #include "texture.h"
+#include "bvh.h"
 
-typedef struct Vertex {
+// a corner of a face as loaded, indexing the arrays of the mesh
+typedef struct Corner {
     int point;
     int normal;
     int coord;
-} Vertex;
+} Corner;
+
+typedef struct Face {
+    Corner corners[3];
+} Face;
 
-// A < B
+// the ends are vertices of the solid, listed once per point
 typedef struct Segment {
     int A;
     int B;
 } Segment;
 
-typedef struct Face {
-    Vertex vertices[3];
-} Face;
-
-typedef struct Solid {
+// the geometry as loaded, each attribute in its own array
+typedef struct Mesh {
     int numVertices;
     int numNormals;
     int numCoords;
     int numSegments;
     int numFaces;
-    Point origin;
     Point *vertices;
     Point *normals;
     Position *coords;
-    Texture *texture;
     Segment *segments;
     Face *faces;
+} Mesh;
+
+typedef struct Vertex {
+    Point point;
+    Point normal;
+    Position coord;
+} Vertex;
+
+// a quantized vertex: the point and the coord in steps of the bounds of
+// the solid, the normal as an octahedral direction
+typedef struct PackedVertex {
+    uint16_t point[3];
+    int16_t normal[2];
+    uint16_t coord[2];
+} PackedVertex;
+
+// the half-edge 3 * f + k goes from the vertex k of the face f to the
+// next one, twin is the opposite half-edge or -1 on a border
+typedef struct HalfEdge {
+    int twin;
+    int crease;
+} HalfEdge;
+
+// a level of detail: its faces follow the ones of the finer levels in
+// the indices and use the first numVertices vertices, error is the
+// distance in the solid its surface may be away from the full one
+typedef struct Lod {
+    int firstFace;
+    int numFaces;
+    int numVertices;
+    float error;
+} Lod;
+
+typedef struct Solid {
+    int numVertices;
+    int numSegments;
+    int numFaces;
+    Point origin;
+    Box bounds;
+    // each distinct corner of the mesh once, packed when quantized
+    Vertex *vertices;
+    PackedVertex *packed;
+    Point low;
+    Point step;
+    Position coordLow;
+    Position coordStep;
+    // the point of the mesh each vertex comes from, for the topology
+    int *points;
+    // 3 per face, on 16 bits when the vertices allow it
+    void *indices;
+    int indexSize;
+    // from the full solid, numFaces, to the coarsest one
+    int numLods;
+    Lod *lods;
+    Texture *texture;
+    // listed the first time the wireframe is drawn
+    Segment *segments;
+    // linked the first time the silhouette is drawn
+    HalfEdge *halfEdges;
+    // over the faces, built on the first query
+    Bvh *bvh;
+    // set when the arrays live in a mapped cache file
+    char *mapping;
+    size_t mappingSize;
 } Solid;
 
-void setSegmentBuild(Segment *u, int A, int B);
-int compareSegmentBuild(const void *u, const void *v);
-void formatSegmentBuild(Solid *solid);
-void addSegmentBuild(Solid *solid, const Segment *segment, int *bufferSize);
+static inline int getIndexBuild(const Solid *solid, int i)
+{
+    return solid->indexSize == sizeof(uint16_t) ? 
+	((const uint16_t *) solid->indices)[i] : 
+	((const uint32_t *) solid->indices)[i];
+}
+
+void decodeVertexBuild(const Solid *solid, int i, Vertex *v);
+
+static inline void getVertexBuild(const Solid *solid, int i, Vertex *v)
+{
+    if (solid->packed)
+	decodeVertexBuild(solid, i, v);
+    else
+	*v = solid->vertices[i];
+}
+
+void weldBuild(Solid *solid, Mesh *mesh);
+void packBuild(Solid *solid);
+void freeMeshBuild(Mesh *mesh);
+void extractSegmentBuild(Solid *solid);
+void linkHalfEdgeBuild(Solid *solid);
+void linkBvhBuild(Solid *solid);
+float getMissRatioBuild(const Solid *solid);
 
 #endif //BUILD_H
@@ -0,0 +1,47 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "point.h"
+
+typedef struct Box {
+    Point low;
+    Point high;
+} Box;
+
+// the points P with scalarProduct(n, P) + d >= 0
+typedef struct Plane {
+    Point n;
+    float d;
+} Plane;
+
+// an inner node has count 0, its left child follows it and first is its
+// right child; a leaf holds the items first to first + count - 1
+typedef struct BvhNode {
+    Box box;
+    int first;
+    int count;
+} BvhNode;
+
+typedef struct Bvh {
+    int numNodes;
+    BvhNode *nodes;
+    int *items;
+} Bvh;
+
+// the distance along d to the item, INFINITY when it is missed
+typedef float (*RayBvh)(void *data, int item, const Point *O, const Point *d);
+typedef void (*VisitBvh)(void *data, int item);
+
+void setBox(Box *box);
+void growBox(Box *box, const Point *A);
+void mergeBox(Box *box, const Box *other);
+float areaBox(const Box *box);
+Bvh *buildBvh(const Box *boxes, int numItems);
+void refitBvh(Bvh *bvh, const Box *boxes);
+float rayBvh(const Bvh *bvh, const Point *O, const Point *d,
+	     RayBvh hit, void *data, int *item);
+void cullBvh(const Bvh *bvh, const Plane *planes, int numPlanes,
+	     VisitBvh visit, void *data);
+void freeBvh(Bvh *bvh);
+
+#endif // BVH_H
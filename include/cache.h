@@ -0,0 +1,9 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "build.h"
+
+Solid *loadCache(const char *fileName, const char *bmpName);
+void saveCache(const char *fileName, const Solid *solid);
+
+#endif // CACHE_H
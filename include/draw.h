@@ -16,5 +16,8 @@ void drawSegment(Lens *l, const Coord *A, const Coord *B,
 		 const Color *color);
 
 void drawTriangle(Lens *l, Texture *triangle, Pixel *A, Pixel *B, Pixel *C);
- 
+
+void getStatsDraw(long *triangles, long *pixels);
+void resetStatsDraw(void);
+
 #endif //DRAW_H
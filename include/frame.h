@@ -16,5 +16,8 @@ void rotateFrameAroundPoint(Frame *f, const Point *axis, float angle);
 void rotateFrame(Frame *frame, float theta, float phi, float rho);
 void translateFrame(Frame *frame, Point *A, float scale);
 void getAbsolutePointFromFrame(const Frame *f, const Point *A, Point *B);
+void getRelativeVectorFromFrame(const Frame *f, const Point *u, Point *v);
+void getRelativePointFromFrame(const Frame *f, const Point *A, Point *B);
+void getNormalFrame(const Frame *f, Frame *n);
 
 #endif // FRAME_H 
@@ -0,0 +1,9 @@
+#ifndef HUD_H
+#define HUD_H
+
+void initHud(void);
+void beginFrameHud(void);
+void endFrameHud(void);
+void drawHud(void);
+
+#endif // HUD_H
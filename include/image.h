@@ -0,0 +1,14 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+
+typedef struct Image Image;
+
+Image *loadImage(const char *fileName);
+int getWidthImage(const Image *image);
+int getHeightImage(const Image *image);
+uint32_t getPixelImage(const Image *image, int w, int h);
+void freeImage(Image *image);
+
+#endif // IMAGE_H
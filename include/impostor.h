@@ -0,0 +1,22 @@
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+#include "point.h"
+#include "color.h"
+#include "frame.h"
+#include "lens.h"
+
+typedef struct Impostor Impostor;
+
+Impostor *initImpostor(void);
+int isValidImpostor(const Impostor *im, const Point *eye, 
+		    const Point *center, const Frame *model, 
+		    const Color *tint, int size);
+Lens *beginImpostor(Impostor *im, Lens *l, const Point *center, 
+		    float radius, int size, const Frame *model, 
+		    const Color *tint);
+void endImpostor(Impostor *im);
+void drawImpostor(Lens *l, Impostor *im);
+void freeImpostor(Impostor *im);
+
+#endif // IMPOSTOR_H
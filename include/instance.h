@@ -0,0 +1,30 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "point.h"
+#include "color.h"
+#include "frame.h"
+#include "solid.h"
+#include "impostor.h"
+
+typedef struct Instance Instance;
+
+Instance *loadInstance(const char *fileName, const char *bmpName);
+Solid *getSolidInstance(Instance *instance);
+Frame *getModelInstance(Instance *instance);
+Point *getOriginInstance(Instance *instance);
+Color *getTintInstance(Instance *instance);
+void setTintInstance(Instance *instance, const Color *tint);
+int getLodInstance(Instance *instance, int lens);
+void setLodInstance(Instance *instance, int lens, int lod);
+Impostor *getImpostorInstance(Instance *instance, int lens);
+
+void scaleInstance(Instance *instance, const Point *O, float scale);
+void rotInstanceXAxis(Instance *instance, const Point *O, float phi);
+void rotInstanceYAxis(Instance *instance, const Point *O, float rho);
+void rotInstanceZAxis(Instance *instance, const Point *O, float theta);
+void translateInstance(Instance *instance, float x, float y, float z);
+
+void freeInstance(Instance *instance);
+
+#endif // INSTANCE_H
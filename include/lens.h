@@ -9,10 +9,14 @@
 typedef struct Lens Lens;
 
 Lens *initLens(char *fileNames);
+Lens *initTargetLens(void);
+void setTargetLens(Lens *l, int width, int height, float fov, 
+		   float nearplan);
 void resetLens(Lens *l);
 void updateLens(Lens *l, Frame *camera);
 void refreshLens(Lens *l, int wD, int hD);
 float *getZBuffer(Lens *l);
+Color *getTarget(Lens *l);
 int getScreenHeight(Lens *l);
 int getScreenWidth(Lens *l);
 float getWfov(Lens *l);
@@ -0,0 +1,8 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include "build.h"
+
+void simplifyLod(Solid *solid);
+
+#endif // LOD_H
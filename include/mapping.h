@@ -0,0 +1,10 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <stddef.h>
+
+const char *mapFile(const char *fileName, size_t *size);
+char *mapCopyFile(const char *fileName, size_t *size);
+void unmapFile(const char *data, size_t size);
+
+#endif // MAPPING_H
@@ -0,0 +1,8 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+void *openNative(const char *source);
+void *getNative(void *native, const char *symbol);
+void closeNative(void *native);
+
+#endif // NATIVE_H
@@ -0,0 +1,17 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include "coord.h"
+
+typedef struct Occlusion Occlusion;
+
+Occlusion *initOcclusion(void);
+void resetOcclusion(Occlusion *o, int width, int height);
+void occludeTriangle(Occlusion *o, const Coord *A, float depthA,
+		     const Coord *B, float depthB,
+		     const Coord *C, float depthC);
+int isOccludedRect(const Occlusion *o, const Coord *low, const Coord *high,
+		   float depth);
+void freeOcclusion(Occlusion *o);
+
+#endif // OCCLUSION_H
@@ -3,7 +3,12 @@
 
 int initEquation(float **min, float **max, int **precision, 
 		 int *nbInput, int *nbOutput, const char *eqName);
+int getSizeEquation(void);
 void getValueFromEquation(float *input, float *output);
+void getValuesFromEquation(float **inputs, float **outputs, int n);
+void initGridEquation(const float *min, const float *interval, 
+		      const int *lengths);
+void getGridValuesFromEquation(int **grids, float **outputs, int n);
 void freeEquation();
 
 #endif // PARAMETRIC_H
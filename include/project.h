@@ -9,6 +9,7 @@
 #include "lens.h"
 
 
+int projectDepth(Lens *l, const Point *A, Coord *S, float *depth);
 void projectVertex(Lens *l, const Point *A, const Color *color);
 void projectSegment(Lens *l, const Point *A, const Point *B, const Color *color);
 void projectTriangle(Lens *l, const Point *A, const Point *B, const Point *C,
@@ -16,5 +17,8 @@ void projectTriangle(Lens *l, const Point *A, const Point *B, const Point *C,
 		     const Position *U, const Position *V, const Position *W,
 		     const Point *normalA, const Point *normalB,
 		     const Point *normalC);
+void projectSprite(Lens *l, const Point *A, const Point *B, const Point *C,
+		   Texture *sprite, 
+		   const Position *U, const Position *V, const Position *W);
 
 #endif //PROJECT_H
@@ -9,6 +9,7 @@ void initScene();
 void askSolidForScene();
 void removeSolidFromScene();
 void drawScene();
+void pickScene(int x, int y);
 void handleArgumentScene(int argc, char *argv[]);
 void resizeCameraScene(int screenWidth, int screenHeight);
 void rotateCameraScene(int direction);
@@ -8,25 +8,33 @@
 #include "position.h"
 #include "texture.h"
 #include "build.h"
+#include "occlusion.h"
 
 Solid *loadSolid(const char *fileName, const char *bmpName);
+void setQuantizationSolid(int enabled);
 
 void calculateOriginSolid(Solid *solid);
 Point *getOriginSolid(Solid *solid);
 
-void wireframeSolid(Lens *l, const Solid *solid, const Color *color);
-void vertexSolid(Lens *l, const Solid *solid, const Color *color);
-void normalSolid(Lens *l, const Solid *solid, const Color *color);
-void drawSolid(Lens *l, const Solid *solid);
+void wireframeSolid(Lens *l, Solid *solid, const Frame *model,
+		    const Color *color);
+void silhouetteSolid(Lens *l, Solid *solid, const Frame *model,
+		     const Color *color);
+void vertexSolid(Lens *l, const Solid *solid, const Frame *model,
+		 const Color *color);
+void normalSolid(Lens *l, const Solid *solid, const Frame *model,
+		 const Color *color);
+void drawSolid(Lens *l, const Solid *solid, const Frame *model, int lod);
 void drawFrame(Lens *l, Frame *frame);
+void occludeSolid(Lens *l, Occlusion *o, const Solid *solid,
+		  const Frame *model);
 
-void scaleSolid(Solid *solid, const Point *O, float scale);
-void rotSolidXAxis(Solid *solid, const Point *O, float phi);
-void rotSolidYAxis(Solid *solid, const Point *O, float rho);
-void rotSolidZAxis(Solid *solid, const Point *O, float theta);
-void translateSolid(Solid *solid, float x, float y, float z);
+float raySolid(Solid *solid, const Frame *model, const Point *O,
+	       const Point *d, int *face);
+void getBoxSolid(const Solid *solid, const Frame *model, Box *box);
 
 void freeSolid(Solid *solid);
+void freeTransformSolid(void);
 
 
 #endif //SOLID_H
@@ -7,7 +7,18 @@
 typedef struct Texture Texture;
 
 Texture *loadTexture(const char *fileName);
-void getPixelTexture(const Texture *texture, const Position *p, Color *c);
+int getLevelTexture(Texture *texture, 
+		    float dudw, float dvdw, float dudh, float dvdh);
+void getPixelTexture(const Texture *texture, int level, const Position *p, 
+		     Color *c);
+Texture *initSpriteTexture(int width, int height);
+void setSpriteTexture(Texture *sprite, const Color *colors, 
+		      const float *offsets);
+int isSpriteTexture(const Texture *texture);
+int getSpriteTexture(const Texture *sprite, const Position *p, Color *c, 
+		     float *offset);
+void setCompressionTexture(int enabled);
+long getMemoryTexture(void);
 void freeTexture(Texture *texture);
 
 #endif //TEXTURE_H
@@ -1,3 +1,3 @@
-#define NB_STATE 5
+#define NB_STATE 7
 
-enum {DRAW, WIREFRAME, NORMAL, VERTEX, FRAME};
+enum {DRAW, WIREFRAME, NORMAL, VERTEX, FRAME, HUD, SILHOUETTE};
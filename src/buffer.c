@@ -1,18 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-void addElementToBuffer(void *element, void **buffer, int *sizeB, int *nbE)
+// buffer is the address of the array, which moves when it grows
+void addElementToBuffer(void *element, void *buffer, int *sizeB, int *nbE)
 {
+    void ***elements = buffer;
     if (!element)
 	return;
     if(*nbE >= *sizeB){
 	(*sizeB) *= 2;
-	buffer = realloc(buffer, (*sizeB) * sizeof(void *));
+	*elements = realloc(*elements, (*sizeB) * sizeof(void *));
     }
-    buffer[(*nbE)++] = element;
+    (*elements)[(*nbE)++] = element;
 }
 
 void removeElementFromBuffer(void *buffer, int *nbE)
 {
-    *nbE > 0 ? (*nbE--) : (*nbE = 0);    
+    *nbE > 0 ? (*nbE)-- : (*nbE = 0);    
 }
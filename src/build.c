@@ -1,52 +1,595 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
 
 #include "build.h"
 
-void setSegmentBuild(Segment *u, int A, int B)
+#define EMPTY UINT64_MAX
+#define NONE -1
+#define CREASE 0.75 // cosine of the smallest crease angle
+#define CACHESIZE 32
+#define CACHEDECAY 1.5
+#define LASTFACESCORE 0.75
+#define VALENCESCALE 2.
+#define VALENCEDECAY 0.5
+#define MAXVALENCE 64
+
+// the state of the face ordering, faces lists the faces of each vertex
+// from starts[v], its remaining ones first
+typedef struct Order {
+    int *remaining;
+    int *starts;
+    int *faces;
+    int *positions;
+    float *scores;
+    char *emitted;
+    int cache[CACHESIZE];
+    int cacheCount;
+    float positionScores[CACHESIZE + 1];
+    float valenceScores[MAXVALENCE];
+} Order;
+
+typedef struct Table {
+    uint64_t *keys;
+    int *values;
+    int mask;
+} Table;
+
+static uint64_t getKey(int A, int B)
+{
+    return (uint64_t) A << 32 | (uint32_t) B;
+}
+
+static int hashKey(uint64_t key, int mask)
+{
+    return (key * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+}
+
+// the table stays at most half full for this number of keys
+static void initTable(Table *table, int numKeys)
+{
+    int size = 64;
+    while (size < 2 * numKeys)
+	size *= 2;
+    table->keys = malloc(size * sizeof(uint64_t));
+    table->values = malloc(size * sizeof(int));
+    table->mask = size - 1;
+    for (int i = 0; i < size; i++)
+	table->keys[i] = EMPTY;
+}
+
+// open addressing with linear probing, returns the slot of the key or
+// the empty slot where it goes
+static int findTable(const Table *table, uint64_t key)
+{
+    int i = hashKey(key, table->mask);
+    while (table->keys[i] != EMPTY && table->keys[i] != key)
+	i = (i + 1) & table->mask;
+    return i;
+}
+
+static void freeTable(Table *table)
+{
+    free(table->keys);
+    free(table->values);
+}
+
+static uint64_t getKeyCorner(const Corner *c)
+{
+    return ((uint64_t) c->point << 40) ^ ((uint64_t) c->normal << 20) ^ 
+	(uint32_t) c->coord;
+}
+
+static int findCorner(const int *table, int mask, const Corner *welded, 
+		      const Corner *c)
+{
+    int i = hashKey(getKeyCorner(c), mask);
+    while (table[i] != NONE && memcmp(&welded[table[i]], c, sizeof(Corner)))
+	i = (i + 1) & mask;
+    return i;
+}
+
+static void setVertex(Vertex *v, const Mesh *mesh, const Corner *c)
+{
+    v->point = mesh->vertices[c->point];
+    if (c->normal != NONE)
+	v->normal = mesh->normals[c->normal];
+    else
+	setPoint(&v->normal, 0., 0., 0.);
+    if (c->coord != NONE)
+	v->coord = mesh->coords[c->coord];
+    else
+	setPosition(&v->coord, 0., 0.);
+}
+
+// vertices transformed per face of the full solid through a FIFO cache of
+// CACHESIZE entries
+float getMissRatioBuild(const Solid *solid)
+{
+    int *stamps = malloc((solid->numVertices + 1) * sizeof(int));
+    int misses = 0;
+    for (int v = 0; v < solid->numVertices; v++)
+	stamps[v] = -CACHESIZE - 1;
+    for (int i = 0; i < 3 * solid->numFaces; i++) {
+	int v = getIndexBuild(solid, i);
+	if (misses - stamps[v] > CACHESIZE)
+	    stamps[v] = misses++;
+    }
+    free(stamps);
+    return solid->numFaces ? (float) misses / solid->numFaces : 0.;
+}
+
+static void initScores(Order *order)
+{
+    order->positionScores[0] = 0.;
+    for (int i = 0; i < CACHESIZE; i++)
+	order->positionScores[i + 1] = i < 3 ? LASTFACESCORE : 
+	    powf(1. - (i - 3) * (1. / (CACHESIZE - 3)), CACHEDECAY);
+    for (int i = 1; i < MAXVALENCE; i++)
+	order->valenceScores[i] = VALENCESCALE * powf(i, -VALENCEDECAY);
+}
+
+// recent vertices score higher, lonely ones too so that they go soon
+static float getScoreVertex(const Order *order, int v)
+{
+    int remaining = order->remaining[v];
+    if (remaining == 0)
+	return -1.;
+    return order->positionScores[order->positions[v] + 1] + 
+	(remaining < MAXVALENCE ? order->valenceScores[remaining] :
+	 VALENCESCALE * powf(remaining, -VALENCEDECAY));
+}
+
+static void initOrder(Order *order, const uint32_t *indices, int numFaces,
+		      int numVertices)
+{
+    initScores(order);
+    order->remaining = calloc(numVertices + 1, sizeof(int));
+    order->starts = malloc((numVertices + 1) * sizeof(int));
+    order->faces = malloc((3 * numFaces + 1) * sizeof(int));
+    order->positions = malloc((numVertices + 1) * sizeof(int));
+    order->scores = malloc((numVertices + 1) * sizeof(float));
+    order->emitted = calloc(numFaces + 1, 1);
+    order->cacheCount = 0;
+
+    for (int i = 0; i < 3 * numFaces; i++)
+	order->remaining[indices[i]]++;
+    for (int v = 0, start = 0; v < numVertices; v++) {
+	order->starts[v] = start;
+	start += order->remaining[v];
+	order->remaining[v] = 0;
+    }
+    for (int i = 0; i < 3 * numFaces; i++) {
+	int v = indices[i];
+	order->faces[order->starts[v] + order->remaining[v]++] = i / 3;
+    }
+    for (int v = 0; v < numVertices; v++) {
+	order->positions[v] = -1;
+	order->scores[v] = getScoreVertex(order, v);
+    }
+}
+
+static void freeOrder(Order *order)
+{
+    free(order->remaining);
+    free(order->starts);
+    free(order->faces);
+    free(order->positions);
+    free(order->scores);
+    free(order->emitted);
+}
+
+static void removeFace(Order *order, int v, int f)
+{
+    int *faces = &order->faces[order->starts[v]];
+    int last = --order->remaining[v];
+    for (int i = 0; i < last; i++) {
+	if (faces[i] == f) {
+	    faces[i] = faces[last];
+	    break;
+	}
+    }
+}
+
+// puts the face vertices in front of the cache, rescores the vertices
+// it holds and returns the best face around them
+static int updateCache(Order *order, const uint32_t *indices, int f)
+{
+    int cache[CACHESIZE + 3];
+    int count = 0;
+    for (int k = 0; k < 3; k++)
+	cache[count++] = indices[3 * f + k];
+    for (int i = 0; i < order->cacheCount; i++) {
+	int v = order->cache[i];
+	if (v != cache[0] && v != cache[1] && v != cache[2])
+	    cache[count++] = v;
+    }
+
+    for (int i = 0; i < count; i++) {
+	int v = cache[i];
+	order->positions[v] = i < CACHESIZE ? i : -1;
+	order->scores[v] = getScoreVertex(order, v);
+    }
+    int best = -1;
+    float bestScore = -1.;
+    for (int i = 0; i < count; i++) {
+	int v = cache[i];
+	const int *faces = &order->faces[order->starts[v]];
+	for (int j = 0; j < order->remaining[v]; j++) {
+	    int g = faces[j];
+	    float score = order->scores[indices[3 * g]] + 
+		order->scores[indices[3 * g + 1]] + 
+		order->scores[indices[3 * g + 2]];
+	    if (score > bestScore) {
+		bestScore = score;
+		best = g;
+	    }
+	}
+    }
+    order->cacheCount = count < CACHESIZE ? count : CACHESIZE;
+    for (int i = 0; i < order->cacheCount; i++)
+	order->cache[i] = cache[i];
+    return best;
+}
+
+// Forsyth's linear-speed vertex cache optimisation: the faces are taken
+// greedily by the score of their vertices in a simulated LRU cache
+static void orderFaces(uint32_t *indices, int numFaces, int numVertices)
+{
+    Order order;
+    initOrder(&order, indices, numFaces, numVertices);
+    uint32_t *ordered = malloc((3 * numFaces + 1) * sizeof(uint32_t));
+    int best = -1;
+    int cursor = 0;
+
+    for (int n = 0; n < numFaces; n++) {
+	if (best < 0) {
+	    while (order.emitted[cursor])
+		cursor++;
+	    best = cursor;
+	}
+	order.emitted[best] = 1;
+	for (int k = 0; k < 3; k++) {
+	    ordered[3 * n + k] = indices[3 * best + k];
+	    removeFace(&order, indices[3 * best + k], best);
+	}
+	best = updateCache(&order, indices, best);
+    }
+    memcpy(indices, ordered, 3 * numFaces * sizeof(uint32_t));
+    free(ordered);
+    freeOrder(&order);
+}
+
+// the vertices are numbered in the order the faces fetch them
+static void renumberVertices(uint32_t *indices, int numIndices, 
+			     Corner *welded, int numVertices)
 {
-    if (A < B) {
-	u->A = A;
-	u->B = B;
-    } else {
-	u->A = B;
-	u->B = A;
+    int *numbers = malloc((numVertices + 1) * sizeof(int));
+    Corner *renumbered = malloc((numVertices + 1) * sizeof(Corner));
+    int n = 0;
+    for (int v = 0; v < numVertices; v++)
+	numbers[v] = NONE;
+    for (int i = 0; i < numIndices; i++) {
+	if (numbers[indices[i]] == NONE) {
+	    numbers[indices[i]] = n;
+	    renumbered[n++] = welded[indices[i]];
+	}
+	indices[i] = numbers[indices[i]];
     }
+    memcpy(welded, renumbered, numVertices * sizeof(Corner));
+    free(renumbered);
+    free(numbers);
 }
 
-int compareSegmentBuild(const void *u, const void *v)
+static void setIndices(Solid *solid, uint32_t *indices)
 {
-    Segment a = *(const Segment *) u;
-    Segment b = *(const Segment *) v;
-    int diff = a.A - b.A;
-    return diff == 0 ? a.B - b.B : diff; 
+    int numIndices = 3 * solid->numFaces;
+    if (solid->numVertices > UINT16_MAX + 1) {
+	solid->indexSize = sizeof(uint32_t);
+	solid->indices = indices;
+	return;
+    }
+    uint16_t *shortIndices = malloc((numIndices + 1) * sizeof(uint16_t));
+    for (int i = 0; i < numIndices; i++)
+	shortIndices[i] = indices[i];
+    free(indices);
+    solid->indexSize = sizeof(uint16_t);
+    solid->indices = shortIndices;
 }
 
-void formatSegmentBuild(Solid *solid)
+// identical corners become one vertex, the faces an index buffer, and
+// the points no face uses are kept for the vertex and segment views
+void weldBuild(Solid *solid, Mesh *mesh)
 {
-    Segment *tmp = malloc(solid->numSegments * sizeof(Segment));
-    int j = 0;
-    if (solid->numSegments > 0) {
-	tmp[0] = solid->segments[0];
-	j++;
+    int numCorners = 3 * mesh->numFaces;
+    int size = 64;
+    while (size < 2 * numCorners)
+	size *= 2;
+    int *table = malloc(size * sizeof(int));
+    for (int i = 0; i < size; i++)
+	table[i] = NONE;
+    Corner *welded = malloc((numCorners + mesh->numVertices + 1) * 
+			    sizeof(Corner));
+    uint32_t *indices = malloc((numCorners + 1) * sizeof(uint32_t));
+    int n = 0;
+
+    for (int i = 0; i < numCorners; i++) {
+	const Corner *c = &mesh->faces[i / 3].corners[i % 3];
+	int slot = findCorner(table, size - 1, welded, c);
+	if (table[slot] == NONE) {
+	    table[slot] = n;
+	    welded[n++] = *c;
+	}
+	indices[i] = table[slot];
     }
-    for (int i = 1; i < solid->numSegments; i++) {
-	if (compareSegmentBuild(&solid->segments[i - 1], &solid->segments[i])) {
-	    tmp[j] = solid->segments[i];
-	    j++;
+    free(table);
+
+    orderFaces(indices, mesh->numFaces, n);
+    renumberVertices(indices, numCorners, welded, n);
+
+    int *first = malloc((mesh->numVertices + 1) * sizeof(int));
+    for (int p = 0; p < mesh->numVertices; p++)
+	first[p] = NONE;
+    for (int v = n - 1; v >= 0; v--)
+	first[welded[v].point] = v;
+    for (int p = 0; p < mesh->numVertices; p++) {
+	if (first[p] == NONE) {
+	    Corner c = { p, NONE, NONE };
+	    first[p] = n;
+	    welded[n++] = c;
 	}
     }
-    solid->numSegments = j;
+
+    solid->numVertices = n;
+    solid->numFaces = mesh->numFaces;
+    solid->vertices = malloc((n + 1) * sizeof(Vertex));
+    solid->points = malloc((n + 1) * sizeof(int));
+    for (int v = 0; v < n; v++) {
+	setVertex(&solid->vertices[v], mesh, &welded[v]);
+	solid->points[v] = welded[v].point;
+    }
+    setIndices(solid, indices);
+
+    if (mesh->segments) {
+	for (int i = 0; i < mesh->numSegments; i++) {
+	    mesh->segments[i].A = first[mesh->segments[i].A];
+	    mesh->segments[i].B = first[mesh->segments[i].B];
+	}
+	solid->segments = mesh->segments;
+	solid->numSegments = mesh->numSegments;
+	mesh->segments = NULL;
+    }
+    free(first);
+    free(welded);
+    freeMeshBuild(mesh);
+}
+
+static uint16_t quantize(float x, float low, float step)
+{
+    return step > 0. ? lroundf((x - low) / step) : 0;
+}
+
+static float sign(float x)
+{
+    return x < 0. ? -1. : 1.;
+}
+
+// the unit octahedron unfolded on a square, the lower half folded on
+// the corners
+static void encodeNormal(const Point *n, int16_t e[2])
+{
+    float l = fabsf(n->x) + fabsf(n->y) + fabsf(n->z);
+    float x = l > 0. ? n->x / l : 0.;
+    float y = l > 0. ? n->y / l : 0.;
+    if (n->z < 0.) {
+	float folded = (1. - fabsf(y)) * sign(x);
+	y = (1. - fabsf(x)) * sign(y);
+	x = folded;
+    }
+    e[0] = lroundf(x * INT16_MAX);
+    e[1] = lroundf(y * INT16_MAX);
+}
+
+static void decodeNormal(const int16_t e[2], Point *n)
+{
+    float x = (float) e[0] / INT16_MAX;
+    float y = (float) e[1] / INT16_MAX;
+    float z = 1. - fabsf(x) - fabsf(y);
+    if (z < 0.) {
+	float unfolded = (1. - fabsf(y)) * sign(x);
+	y = (1. - fabsf(x)) * sign(y);
+	x = unfolded;
+    }
+    setPoint(n, x, y, z);
+    normalizePoint(n, n);
+}
+
+void decodeVertexBuild(const Solid *solid, int i, Vertex *v)
+{
+    const PackedVertex *p = &solid->packed[i];
+    setPoint(&v->point,
+	     solid->low.x + p->point[0] * solid->step.x,
+	     solid->low.y + p->point[1] * solid->step.y,
+	     solid->low.z + p->point[2] * solid->step.z);
+    decodeNormal(p->normal, &v->normal);
+    setPosition(&v->coord,
+		solid->coordLow.x + p->coord[0] * solid->coordStep.x,
+		solid->coordLow.y + p->coord[1] * solid->coordStep.y);
+}
+
+static void getBounds(Solid *solid, const Vertex *vertices)
+{
+    Vertex low = {0}, high = {0};
+    if (solid->numVertices > 0)
+	low = high = vertices[0];
+    for (int i = 1; i < solid->numVertices; i++) {
+	const Vertex *v = &vertices[i];
+	low.point.x = fminf(low.point.x, v->point.x);
+	low.point.y = fminf(low.point.y, v->point.y);
+	low.point.z = fminf(low.point.z, v->point.z);
+	high.point.x = fmaxf(high.point.x, v->point.x);
+	high.point.y = fmaxf(high.point.y, v->point.y);
+	high.point.z = fmaxf(high.point.z, v->point.z);
+	low.coord.x = fminf(low.coord.x, v->coord.x);
+	low.coord.y = fminf(low.coord.y, v->coord.y);
+	high.coord.x = fmaxf(high.coord.x, v->coord.x);
+	high.coord.y = fmaxf(high.coord.y, v->coord.y);
+    }
+    solid->low = low.point;
+    solid->coordLow = low.coord;
+    setPoint(&solid->step,
+	     (high.point.x - low.point.x) / UINT16_MAX,
+	     (high.point.y - low.point.y) / UINT16_MAX,
+	     (high.point.z - low.point.z) / UINT16_MAX);
+    setPosition(&solid->coordStep,
+		(high.coord.x - low.coord.x) / UINT16_MAX,
+		(high.coord.y - low.coord.y) / UINT16_MAX);
+}
+
+// points and coords are rounded to a 65535th of the extent of the solid
+// on each axis, normals to less than 0.01 degree; the float vertices are
+// dropped, or left to the cache mapping
+void packBuild(Solid *solid)
+{
+    if (solid->packed)
+	return;
+    int n = solid->numVertices;
+    getBounds(solid, solid->vertices);
+
+    solid->packed = malloc((n + 1) * sizeof(PackedVertex));
+    for (int i = 0; i < n; i++) {
+	const Vertex *v = &solid->vertices[i];
+	PackedVertex *p = &solid->packed[i];
+	p->point[0] = quantize(v->point.x, solid->low.x, solid->step.x);
+	p->point[1] = quantize(v->point.y, solid->low.y, solid->step.y);
+	p->point[2] = quantize(v->point.z, solid->low.z, solid->step.z);
+	encodeNormal(&v->normal, p->normal);
+	p->coord[0] = quantize(v->coord.x, solid->coordLow.x, 
+			       solid->coordStep.x);
+	p->coord[1] = quantize(v->coord.y, solid->coordLow.y, 
+			       solid->coordStep.y);
+    }
+    if (solid->mapping == NULL)
+	free(solid->vertices);
+    solid->vertices = NULL;
+}
+
+void freeMeshBuild(Mesh *mesh)
+{
+    free(mesh->vertices);
+    free(mesh->normals);
+    free(mesh->coords);
+    free(mesh->segments);
+    free(mesh->faces);
+}
+
+static int getVertexHalfEdge(const Solid *solid, int h, int k)
+{
+    return getIndexBuild(solid, h - h % 3 + (h + k) % 3);
+}
+
+static int getPointHalfEdge(const Solid *solid, int h, int k)
+{
+    return solid->points[getVertexHalfEdge(solid, h, k)];
+}
+
+// lists each edge of the faces once, vertices of a same point being one
+void extractSegmentBuild(Solid *solid)
+{
+    // open meshes have up to one segment per half-edge
+    Table table;
+    initTable(&table, 3 * solid->numFaces);
+    int bufferSize = 3 * solid->numFaces / 2 + 1;
     free(solid->segments);
-    solid->segments = realloc(tmp, j * sizeof(Segment));  
+    solid->segments = malloc(bufferSize * sizeof(Segment));
+    solid->numSegments = 0;
+
+    for (int h = 0; h < 3 * solid->numFaces; h++) {
+	int A = getPointHalfEdge(solid, h, 0);
+	int B = getPointHalfEdge(solid, h, 1);
+	uint64_t key = A < B ? getKey(A, B) : getKey(B, A);
+	int slot = findTable(&table, key);
+	if (table.keys[slot] != EMPTY)
+	    continue;
+	table.keys[slot] = key;
+	if (solid->numSegments >= bufferSize) {
+	    bufferSize *= 2;
+	    solid->segments = realloc(solid->segments, 
+				      bufferSize * sizeof(Segment));
+	}
+	Segment *u = &solid->segments[solid->numSegments++];
+	u->A = getVertexHalfEdge(solid, h, 0);
+	u->B = getVertexHalfEdge(solid, h, 1);
+    }
+    freeTable(&table);
+    solid->segments = realloc(solid->segments, 
+			      (solid->numSegments + 1) * sizeof(Segment));
+}
+
+static void getNormalFace(const Solid *solid, int f, Point *n)
+{
+    Vertex A, B, C;
+    getVertexBuild(solid, getIndexBuild(solid, 3 * f), &A);
+    getVertexBuild(solid, getIndexBuild(solid, 3 * f + 1), &B);
+    getVertexBuild(solid, getIndexBuild(solid, 3 * f + 2), &C);
+    normal(&A.point, &B.point, &C.point, n);
+}
+
+// pairs each half-edge with the opposite one of the neighbour face; on
+// an edge of more than two faces or of faces in opposite orientations,
+// the half-edges left without a mutual twin are borders
+void linkHalfEdgeBuild(Solid *solid)
+{
+    Table table;
+    initTable(&table, 3 * solid->numFaces);
+    free(solid->halfEdges);
+    solid->halfEdges = malloc((3 * solid->numFaces + 1) * sizeof(HalfEdge));
+
+    for (int h = 0; h < 3 * solid->numFaces; h++) {
+	uint64_t key = getKey(getPointHalfEdge(solid, h, 0), 
+			      getPointHalfEdge(solid, h, 1));
+	int slot = findTable(&table, key);
+	if (table.keys[slot] == EMPTY) {
+	    table.keys[slot] = key;
+	    table.values[slot] = h;
+	}
+    }
+    for (int h = 0; h < 3 * solid->numFaces; h++) {
+	HalfEdge *e = &solid->halfEdges[h];
+	int slot = findTable(&table, getKey(getPointHalfEdge(solid, h, 1), 
+					    getPointHalfEdge(solid, h, 0)));
+	e->twin = table.keys[slot] == EMPTY ? NONE : table.values[slot];
+    }
+    // a half-edge keeping its twin was chosen back by it, so it is never
+    // unlinked here
+    for (int h = 0; h < 3 * solid->numFaces; h++) {
+	HalfEdge *e = &solid->halfEdges[h];
+	if (e->twin != NONE && solid->halfEdges[e->twin].twin != h)
+	    e->twin = NONE;
+	e->crease = 0;
+	if (e->twin != NONE) {
+	    Point n, m;
+	    getNormalFace(solid, h / 3, &n);
+	    getNormalFace(solid, e->twin / 3, &m);
+	    e->crease = scalarProduct(&n, &m) < CREASE;
+	}
+    }
+    freeTable(&table);
 }
 
-void addSegmentBuild(Solid *solid, const Segment *segment, int *bufferSize)
+void linkBvhBuild(Solid *solid)
 {
-    if(solid->numSegments >= *bufferSize){
-	*bufferSize *= 2;
-	solid->segments = realloc(solid->segments, 
-				  *bufferSize * sizeof(Segment));
+    Box *boxes = malloc((solid->numFaces + 1) * sizeof(Box));
+    for (int f = 0; f < solid->numFaces; f++) {
+	setBox(&boxes[f]);
+	for (int k = 0; k < 3; k++) {
+	    Vertex v;
+	    getVertexBuild(solid, getIndexBuild(solid, 3 * f + k), &v);
+	    growBox(&boxes[f], &v.point);
+	}
     }
-    solid->segments[solid->numSegments++] = *segment;   
+    solid->bvh = buildBvh(boxes, solid->numFaces);
+    free(boxes);
 }
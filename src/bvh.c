@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "point.h"
+#include "bvh.h"
+
+#define NUMBINS 12
+#define MAXLEAF 4
+#define MAXDEPTH 64
+
+void setBox(Box *box)
+{
+    setPoint(&box->low, INFINITY, INFINITY, INFINITY);
+    setPoint(&box->high, -INFINITY, -INFINITY, -INFINITY);
+}
+
+void growBox(Box *box, const Point *A)
+{
+    setPoint(&box->low,
+	     fminf(box->low.x, A->x),
+	     fminf(box->low.y, A->y),
+	     fminf(box->low.z, A->z));
+    setPoint(&box->high,
+	     fmaxf(box->high.x, A->x),
+	     fmaxf(box->high.y, A->y),
+	     fmaxf(box->high.z, A->z));
+}
+
+void mergeBox(Box *box, const Box *other)
+{
+    growBox(box, &other->low);
+    growBox(box, &other->high);
+}
+
+// half the surface of the box
+float areaBox(const Box *box)
+{
+    Point e;
+    diffPoint(&box->high, &box->low, &e);
+    if (e.x < 0.)
+	return 0.;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+static float getAxis(const Point *A, int axis)
+{
+    return axis == 0 ? A->x : axis == 1 ? A->y : A->z;
+}
+
+static int getBin(const Point *center, int axis, float low, float extent)
+{
+    int b = (getAxis(center, axis) - low) / extent * NUMBINS;
+    return b < NUMBINS ? b : NUMBINS - 1;
+}
+
+// the items are binned by their center along the widest axis, the
+// split between bins of least surface area heuristic cost wins
+static int buildNode(Bvh *bvh, const Box *boxes, const Point *centers,
+		     int first, int count, int depth)
+{
+    int node = bvh->numNodes++;
+    BvhNode *n = &bvh->nodes[node];
+    Box bounds;
+    setBox(&n->box);
+    setBox(&bounds);
+    for (int i = first; i < first + count; i++) {
+	mergeBox(&n->box, &boxes[bvh->items[i]]);
+	growBox(&bounds, &centers[bvh->items[i]]);
+    }
+    n->first = first;
+    n->count = count;
+    if (count <= MAXLEAF || depth >= MAXDEPTH)
+	return node;
+
+    Point e;
+    diffPoint(&bounds.high, &bounds.low, &e);
+    int axis = e.x >= e.y && e.x >= e.z ? 0 : e.y >= e.z ? 1 : 2;
+    float low = getAxis(&bounds.low, axis);
+    float extent = getAxis(&e, axis);
+
+    int mid = first + count / 2;
+    if (extent > 0.) {
+	Box binBoxes[NUMBINS];
+	int binCounts[NUMBINS] = {0};
+	for (int b = 0; b < NUMBINS; b++)
+	    setBox(&binBoxes[b]);
+	for (int i = first; i < first + count; i++) {
+	    int b = getBin(&centers[bvh->items[i]], axis, low, extent);
+	    binCounts[b]++;
+	    mergeBox(&binBoxes[b], &boxes[bvh->items[i]]);
+	}
+
+	float rightCosts[NUMBINS];
+	Box side;
+	int sideCount = 0;
+	setBox(&side);
+	for (int b = NUMBINS - 1; b > 0; b--) {
+	    mergeBox(&side, &binBoxes[b]);
+	    sideCount += binCounts[b];
+	    rightCosts[b] = areaBox(&side) * sideCount;
+	}
+	float best = INFINITY;
+	int split = 0;
+	sideCount = 0;
+	setBox(&side);
+	for (int b = 0; b < NUMBINS - 1; b++) {
+	    mergeBox(&side, &binBoxes[b]);
+	    sideCount += binCounts[b];
+	    float cost = areaBox(&side) * sideCount + rightCosts[b + 1];
+	    if (sideCount > 0 && sideCount < count && cost < best) {
+		best = cost;
+		split = b + 1;
+	    }
+	}
+
+	// a step down costs as much as testing one item
+	float area = areaBox(&n->box);
+	if (area > 0. && 1. + best / area >= count && count <= 4 * MAXLEAF)
+	    return node;
+	if (split > 0) {
+	    mid = first;
+	    for (int i = first; i < first + count; i++) {
+		int item = bvh->items[i];
+		if (getBin(&centers[item], axis, low, extent) < split) {
+		    bvh->items[i] = bvh->items[mid];
+		    bvh->items[mid++] = item;
+		}
+	    }
+	}
+    }
+
+    buildNode(bvh, boxes, centers, first, mid - first, depth + 1);
+    int right = buildNode(bvh, boxes, centers, mid, first + count - mid, 
+			  depth + 1);
+    bvh->nodes[node].first = right;
+    bvh->nodes[node].count = 0;
+    return node;
+}
+
+Bvh *buildBvh(const Box *boxes, int numItems)
+{
+    Bvh *bvh = malloc(sizeof(Bvh));
+    bvh->numNodes = 0;
+    bvh->nodes = malloc((2 * numItems + 1) * sizeof(BvhNode));
+    bvh->items = malloc((numItems + 1) * sizeof(int));
+    Point *centers = malloc((numItems + 1) * sizeof(Point));
+    for (int i = 0; i < numItems; i++) {
+	bvh->items[i] = i;
+	setPoint(&centers[i],
+		 (boxes[i].low.x + boxes[i].high.x) / 2.,
+		 (boxes[i].low.y + boxes[i].high.y) / 2.,
+		 (boxes[i].low.z + boxes[i].high.z) / 2.);
+    }
+    if (numItems > 0)
+	buildNode(bvh, boxes, centers, 0, numItems, 0);
+    free(centers);
+    return bvh;
+}
+
+// the children come after their parent, the boxes are grown back to
+// front; the tree keeps its shape, however far the items moved
+void refitBvh(Bvh *bvh, const Box *boxes)
+{
+    for (int i = bvh->numNodes - 1; i >= 0; i--) {
+	BvhNode *n = &bvh->nodes[i];
+	if (n->count > 0) {
+	    setBox(&n->box);
+	    for (int j = n->first; j < n->first + n->count; j++)
+		mergeBox(&n->box, &boxes[bvh->items[j]]);
+	} else {
+	    n->box = bvh->nodes[i + 1].box;
+	    mergeBox(&n->box, &bvh->nodes[n->first].box);
+	}
+    }
+}
+
+// the distance to the box along the ray before tmax, INFINITY otherwise
+static float hitBox(const Box *box, const Point *O, const Point *inv,
+		    float tmax)
+{
+    float x1 = (box->low.x - O->x) * inv->x;
+    float x2 = (box->high.x - O->x) * inv->x;
+    float y1 = (box->low.y - O->y) * inv->y;
+    float y2 = (box->high.y - O->y) * inv->y;
+    float z1 = (box->low.z - O->z) * inv->z;
+    float z2 = (box->high.z - O->z) * inv->z;
+    float tnear = fmaxf(fmaxf(fminf(x1, x2), fminf(y1, y2)),
+			fmaxf(fminf(z1, z2), 0.));
+    float tfar = fminf(fminf(fmaxf(x1, x2), fmaxf(y1, y2)),
+		       fminf(fmaxf(z1, z2), tmax));
+    return tnear <= tfar ? tnear : INFINITY;
+}
+
+float rayBvh(const Bvh *bvh, const Point *O, const Point *d,
+	     RayBvh hit, void *data, int *item)
+{
+    float best = INFINITY;
+    int stack[MAXDEPTH + 2];
+    int top = 0;
+    Point inv;
+    setPoint(&inv, 1. / d->x, 1. / d->y, 1. / d->z);
+    if (bvh->numNodes > 0)
+	stack[top++] = 0;
+
+    while (top > 0) {
+	int node = stack[--top];
+	const BvhNode *n = &bvh->nodes[node];
+	if (hitBox(&n->box, O, &inv, best) == INFINITY)
+	    continue;
+	if (n->count == 0) {
+	    // the nearer child is popped first
+	    int near = node + 1, far = n->first;
+	    if (hitBox(&bvh->nodes[near].box, O, &inv, best) >
+		hitBox(&bvh->nodes[far].box, O, &inv, best)) {
+		near = n->first;
+		far = node + 1;
+	    }
+	    stack[top++] = far;
+	    stack[top++] = near;
+	    continue;
+	}
+	for (int i = n->first; i < n->first + n->count; i++) {
+	    float t = hit(data, bvh->items[i], O, d);
+	    if (t < best) {
+		best = t;
+		*item = bvh->items[i];
+	    }
+	}
+    }
+    return best;
+}
+
+static int isOutsidePlane(const Box *box, const Plane *p)
+{
+    Point A;
+    setPoint(&A,
+	     p->n.x > 0. ? box->high.x : box->low.x,
+	     p->n.y > 0. ? box->high.y : box->low.y,
+	     p->n.z > 0. ? box->high.z : box->low.z);
+    return scalarProduct(&p->n, &A) + p->d < 0.;
+}
+
+// visits the items of the leaves not fully outside one of the planes
+void cullBvh(const Bvh *bvh, const Plane *planes, int numPlanes,
+	     VisitBvh visit, void *data)
+{
+    int stack[MAXDEPTH + 2];
+    int top = 0;
+    if (bvh->numNodes > 0)
+	stack[top++] = 0;
+
+    while (top > 0) {
+	int node = stack[--top];
+	const BvhNode *n = &bvh->nodes[node];
+	int outside = 0;
+	for (int p = 0; p < numPlanes && !outside; p++)
+	    outside = isOutsidePlane(&n->box, &planes[p]);
+	if (outside)
+	    continue;
+	if (n->count == 0) {
+	    stack[top++] = n->first;
+	    stack[top++] = node + 1;
+	    continue;
+	}
+	for (int i = n->first; i < n->first + n->count; i++)
+	    visit(data, bvh->items[i]);
+    }
+}
+
+void freeBvh(Bvh *bvh)
+{
+    if (bvh == NULL)
+	return;
+    free(bvh->nodes);
+    free(bvh->items);
+    free(bvh);
+}
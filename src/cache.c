@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "build.h"
+#include "texture.h"
+#include "mapping.h"
+
+#define MAXLENGTH 256
+#define CACHEMAGIC 0x48434433 // "3DCH"
+#define CACHEVERSION 5
+#define CACHEALIGN 64
+
+typedef struct Section {
+    uint64_t offset;
+    int64_t count;
+} Section;
+
+// the arrays follow the header, each one aligned on CACHEALIGN bytes
+typedef struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    int64_t mtime;
+    int64_t mtimeNsec;
+    int64_t sourceSize;
+    int64_t indexSize;
+    Section vertices;
+    Section points;
+    Section indices;
+    Section lods;
+} Header;
+
+static uint64_t hashName(const char *name)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *name; name++)
+	hash = (hash ^ (unsigned char) *name) * 1099511628211ULL;
+    return hash;
+}
+
+static int getCacheName(const char *fileName, char *cacheName)
+{
+    return snprintf(cacheName, MAXLENGTH, "%s.cache", fileName) < MAXLENGTH;
+}
+
+// the source identifies the cache by its name, its size and its date
+static int setKeyHeader(Header *h, const char *fileName)
+{
+    struct stat st;
+    FILE *file = fopen(fileName, "r");
+    if (file == NULL)
+	return 0;
+    int ok = fstat(fileno(file), &st) != -1;
+    fclose(file);
+
+    memset(h, 0, sizeof(Header));
+    h->version = CACHEVERSION;
+    h->hash = hashName(fileName);
+    h->mtime = st.st_mtim.tv_sec;
+    h->mtimeNsec = st.st_mtim.tv_nsec;
+    h->sourceSize = st.st_size;
+    return ok;
+}
+
+static uint64_t setSection(Section *s, uint64_t offset, int count, 
+			   size_t dataSize)
+{
+    s->offset = (offset + CACHEALIGN - 1) & ~(uint64_t) (CACHEALIGN - 1);
+    s->count = count;
+    return s->offset + count * dataSize;
+}
+
+static void *getSection(char *data, size_t size, const Section *s, 
+			size_t dataSize, int *count)
+{
+    if (s->count < 0 || s->count > INT32_MAX || s->offset % CACHEALIGN ||
+	s->offset > size || (size - s->offset) / dataSize < s->count)
+	return NULL;
+    *count = s->count;
+    return data + s->offset;
+}
+
+static int writeSection(FILE *file, const Section *s, const void *array, 
+			size_t dataSize)
+{
+    static const char padding[CACHEALIGN];
+    long position = ftell(file);
+    return position >= 0 && position <= s->offset &&
+	fwrite(padding, 1, s->offset - position, file) == 
+	s->offset - position &&
+	fwrite(array, dataSize, s->count, file) == s->count;
+}
+
+// every index names a vertex of the solid, each level lies in the
+// indices and uses a prefix of the vertices, and the full solid is the
+// first level
+static int checkIndices(const Solid *solid, int numIndices)
+{
+    for (int i = 0; i < numIndices; i++)
+	if (getIndexBuild(solid, i) >= solid->numVertices)
+	    return 0;
+    for (int v = 0; v < solid->numVertices; v++)
+	if (solid->points[v] < 0)
+	    return 0;
+    if (solid->numLods > 0 && solid->lods[0].firstFace != 0)
+	return 0;
+    for (int k = 0; k < solid->numLods; k++) {
+	const Lod *lod = &solid->lods[k];
+	if (lod->firstFace < 0 || lod->numFaces < 0 || 
+	    lod->firstFace > numIndices / 3 - lod->numFaces ||
+	    lod->numVertices < 0 || lod->numVertices > solid->numVertices)
+	    return 0;
+	for (int i = 3 * lod->firstFace; 
+	     i < 3 * (lod->firstFace + lod->numFaces); i++)
+	    if (getIndexBuild(solid, i) >= lod->numVertices)
+		return 0;
+    }
+    return 1;
+}
+
+static int loadSections(Solid *solid, const Header *h, char *data, 
+			size_t size)
+{
+    int numPoints = 0, numIndices = 0;
+    if (h->indexSize != sizeof(uint16_t) && h->indexSize != sizeof(uint32_t))
+	return 0;
+    solid->indexSize = h->indexSize;
+    solid->vertices = getSection(data, size, &h->vertices, sizeof(Vertex), 
+				 &solid->numVertices);
+    solid->points = getSection(data, size, &h->points, sizeof(int), 
+			       &numPoints);
+    solid->indices = getSection(data, size, &h->indices, h->indexSize, 
+				&numIndices);
+    solid->lods = getSection(data, size, &h->lods, sizeof(Lod), 
+			     &solid->numLods);
+    solid->numFaces = solid->numLods ? solid->lods[0].numFaces : 
+	numIndices / 3;
+    if (solid->numLods == 0)
+	solid->lods = NULL;
+    return solid->vertices && solid->points && solid->indices &&
+	(solid->lods || h->lods.count == 0) &&
+	numPoints == solid->numVertices && numIndices % 3 == 0 &&
+	checkIndices(solid, numIndices);
+}
+
+Solid *loadCache(const char *fileName, const char *bmpName)
+{
+    char cacheName[MAXLENGTH];
+    Header key;
+    size_t size;
+    char *data;
+    if (!getCacheName(fileName, cacheName) || !setKeyHeader(&key, fileName) ||
+	!(data = mapCopyFile(cacheName, &size)))
+	return NULL;
+
+    const Header *h = (const Header *) data;
+    Solid *solid = calloc(1, sizeof(Solid));
+    if (size < sizeof(Header) || h->magic != CACHEMAGIC || 
+	h->version != key.version || h->hash != key.hash || 
+	h->mtime != key.mtime || h->mtimeNsec != key.mtimeNsec || 
+	h->sourceSize != key.sourceSize || 
+	!loadSections(solid, h, data, size)) {
+	unmapFile(data, size);
+	free(solid);
+	return NULL;
+    }
+    solid->mapping = data;
+    solid->mappingSize = size;
+
+    if ((solid->texture = loadTexture(bmpName)))
+	printf("Texture successfully loaded\n");
+    else
+	printf("Error loading texture\n");
+    printf("Object successfully loaded from %s\n", cacheName);
+    return solid;
+}
+
+// fopen looks for relative names next to the executable first (see
+// ext.c), rename would not: the full name of the file is read back
+static int getOpenedName(FILE *file, char *name)
+{
+    char link[MAXLENGTH];
+    snprintf(link, MAXLENGTH, "/proc/self/fd/%d", fileno(file));
+    ssize_t length = readlink(link, name, MAXLENGTH - 1);
+    if (length < 0 || length == MAXLENGTH - 1)
+	return 0;
+    name[length] = '\0';
+    return 1;
+}
+
+// the cache is written under a temporary name then renamed, so that
+// another instance mapping the previous one keeps its pages, and an
+// interrupted save is never loaded
+void saveCache(const char *fileName, const Solid *solid)
+{
+    char cacheName[MAXLENGTH], tempName[MAXLENGTH], path[MAXLENGTH];
+    Header h;
+    if (!getCacheName(fileName, cacheName) || !setKeyHeader(&h, fileName) ||
+	snprintf(tempName, MAXLENGTH, "%s.%d", cacheName, (int) getpid()) 
+	>= MAXLENGTH)
+	return;
+    uint64_t offset = sizeof(Header);
+    h.indexSize = solid->indexSize;
+    offset = setSection(&h.vertices, offset, solid->numVertices, 
+			sizeof(Vertex));
+    offset = setSection(&h.points, offset, solid->numVertices, sizeof(int));
+    int numFaces = solid->numFaces;
+    for (int k = 1; k < solid->numLods; k++)
+	numFaces += solid->lods[k].numFaces;
+    offset = setSection(&h.indices, offset, 3 * numFaces, solid->indexSize);
+    offset = setSection(&h.lods, offset, solid->numLods, sizeof(Lod));
+
+    FILE *file = fopen(tempName, "w");
+    if (file == NULL)
+	return;
+    if (!getOpenedName(file, path)) {
+	fclose(file);
+	remove(tempName);
+	return;
+    }
+    h.magic = CACHEMAGIC;
+    int ok = fwrite(&h, sizeof(Header), 1, file) == 1 &&
+	writeSection(file, &h.vertices, solid->vertices, sizeof(Vertex)) &&
+	writeSection(file, &h.points, solid->points, sizeof(int)) &&
+	writeSection(file, &h.indices, solid->indices, solid->indexSize) &&
+	writeSection(file, &h.lods, solid->lods, sizeof(Lod));
+    ok = fclose(file) == 0 && ok;
+
+    // the final name is the full name of the temporary file without its
+    // suffix
+    int length = strlen(path) - (strlen(tempName) - strlen(cacheName));
+    snprintf(cacheName, MAXLENGTH, "%.*s", length, path);
+    if (!ok || rename(path, cacheName) != 0) {
+	fprintf(stderr, "Error writing %s\n", cacheName);
+	remove(path);
+    }
+}
@@ -56,6 +56,8 @@ static void initStateCamera(Camera *c)
     c->state[NORMAL] = 0;
     c->state[VERTEX] = 0;
     c->state[FRAME] = 1;
+    c->state[HUD] = 0;
+    c->state[SILHOUETTE] = 0;
 }
 
 static void loadDefaultCamera(Camera *c)
@@ -9,6 +9,11 @@
 #include "display.h"
 #include "pixel.h"
 
+static struct {
+    long triangles;
+    long pixels;
+} stats;
+
 static inline int min(int a, int b)
 {
     return (a < b) ? a : b;
@@ -21,6 +26,12 @@ static inline int max(int a, int b)
 
 static void translatePixel(Lens *l, const Coord *A, const Color *color)
 {
+    Color *target = getTarget(l);
+    if (target) {
+	target[A->w + A->h * getScreenWidth(l)] = *color;
+	stats.pixels++;
+	return;
+    }
     Coord B = *A;
     Color filtered = *color;
     translateCoord(&B, getWidthPosition(l), getHeightPosition(l));
@@ -31,6 +42,7 @@ static void translatePixel(Lens *l, const Coord *A, const Color *color)
 	averageColor(&filtered, &back, 128);
     }
     setPixelDisplay(&B, &filtered);
+    stats.pixels++;
 }
 
 void drawPixel(Lens *l, const Coord *A, float depthA, const Color *color)
@@ -114,6 +126,84 @@ void drawSegment(Lens *l, const Coord *A, const Coord *B,
     }
 }
 
+// perspective correct texture position of the point of barycentric
+// coordinates alpha, beta and gamma, u, v and w being the positions of
+// A, B and C divided by their depth
+static void getPositionTriangle(const Pixel *A, const Pixel *B, const Pixel *C,
+				const Position *u, const Position *v,
+				const Position *w,
+				float alpha, float beta, float gamma, Position *N)
+{
+    float denominator = (alpha / A->depth + 
+			 beta / B->depth + 
+			 gamma / C->depth);
+    N->x = (alpha * u->x + beta * v->x + gamma * w->x) / denominator;
+    N->y = (alpha * u->y + beta * v->y + gamma * w->y) / denominator;
+}
+
+// same as above for any M, which may lie outside of the triangle
+static void getPositionCoord(const Pixel *A, const Pixel *B, const Pixel *C,
+			     const Position *u, const Position *v,
+			     const Position *w,
+			     const Coord *M, Position *N)
+{
+    Coord AB, BC, CA, AM, BM, CM;
+    diffCoord(&B->c, &A->c, &AB);
+    diffCoord(&C->c, &B->c, &BC);
+    diffCoord(&A->c, &C->c, &CA);
+    diffCoord(M, &A->c, &AM);
+    diffCoord(M, &B->c, &BM);
+    diffCoord(M, &C->c, &CM);
+    float det = productCoord(&CA, &AB);
+    getPositionTriangle(A, B, C, u, v, w,
+			productCoord(&BC, &BM) / det,
+			productCoord(&CA, &CM) / det,
+			productCoord(&AB, &AM) / det, N);
+}
+
+// mipmap level of the span starting at M, chosen from the derivatives of
+// the texture position along both screen axes
+static int getLevelSpan(Texture *triangle,
+			const Pixel *A, const Pixel *B, const Pixel *C,
+			const Position *u, const Position *v, const Position *w,
+			const Coord *M)
+{
+    Position N, Nw, Nh;
+    Coord Mw, Mh;
+    setCoord(&Mw, M->w + 1, M->h);
+    setCoord(&Mh, M->w, M->h + 1);
+    getPositionCoord(A, B, C, u, v, w, M, &N);
+    getPositionCoord(A, B, C, u, v, w, &Mw, &Nw);
+    getPositionCoord(A, B, C, u, v, w, &Mh, &Nh);
+    return getLevelTexture(triangle, 
+			   Nw.x - N.x, Nw.y - N.y, 
+			   Nh.x - N.x, Nh.y - N.y);
+}
+
+// the light of the point of barycentric coordinates alpha, beta and
+// gamma on its texel, or on the untextured color
+static void shadeTriangle(Texture *triangle, int level,
+			  const Pixel *A, const Pixel *B, const Pixel *C,
+			  const Position *u, const Position *v,
+			  const Position *w,
+			  float alpha, float beta, float gamma, Color *c)
+{
+    Color colorM;
+    interpolateColor(&colorM, 
+		     &A->light, &B->light, &C->light, 
+		     alpha, beta, gamma);
+
+    if (triangle) {
+	Position N;
+	getPositionTriangle(A, B, C, u, v, w, 
+			    alpha, beta, gamma, &N);
+	getPixelTexture(triangle, level, &N, c);
+    } else {
+	getUntexturedDisplay(c);
+    }
+    productColor(c, &colorM, c);
+}
+
 void drawTriangle(Lens *l, Texture *triangle, Pixel *A, Pixel *B, Pixel *C)
 {
     Coord AB, BC, CA;
@@ -123,6 +213,7 @@ void drawTriangle(Lens *l, Texture *triangle, Pixel *A, Pixel *B, Pixel *C)
 
     if (productCoord(&AB, &BC) <= 0)
 	return;
+    stats.triangles++;
 
     float *zB = getZBuffer(l);
     float nearplan = getNearplan(l);
@@ -142,6 +233,7 @@ void drawTriangle(Lens *l, Texture *triangle, Pixel *A, Pixel *B, Pixel *C)
     float depthCA = C->depth * A->depth;
 
     Position u, v, w;
+    int sprite = triangle && isSpriteTexture(triangle);
 
     if (triangle) {
 	setPosition(&u, A->p.x / A->depth, A->p.y / A->depth);
@@ -155,6 +247,7 @@ void drawTriangle(Lens *l, Texture *triangle, Pixel *A, Pixel *B, Pixel *C)
     for (M.h = minH; M.h <= maxH; ++M.h) {
 	Coord AM, BM, CM;
 	int PAlpha, PBeta, PGamma;
+	int level = 0;
 	M.w = minW;
 
 	do {
@@ -167,6 +260,8 @@ void drawTriangle(Lens *l, Texture *triangle, Pixel *A, Pixel *B, Pixel *C)
 		  productCoord(&BC, &BM) < 0 || 
 		  productCoord(&CA, &CM) < 0));
 	M.w--;
+	if (triangle && !sprite && M.w <= maxW)
+	    level = getLevelSpan(triangle, A, B, C, &u, &v, &w, &M);
 	while (M.w <= maxW && 
 	       (PAlpha = productCoord(&BC, &BM)) >= 0 && 
 	       (PBeta = productCoord(&CA, &CM)) >= 0 && 
@@ -178,31 +273,24 @@ void drawTriangle(Lens *l, Texture *triangle, Pixel *A, Pixel *B, Pixel *C)
 
 	    float depthM = depthABC / 
 		(alpha * depthBC + beta * depthCA + gamma * depthAB);
+	    Color c;
+	    int covered = 1;
 
-	    if (zB[M.w + M.h * sW] < nearplan || 
-		zB[M.w + M.h * sW] > depthM) {
-		Color colorM;
-		Color c;
-		interpolateColor(&colorM, 
-				 &A->light, &B->light, &C->light, 
-				 alpha, beta, gamma);
-		
-		if (triangle) {
-		    float denominator = (alpha / A->depth + 
-					 beta / B->depth + 
-					 gamma / C->depth);
-		    Position N;
-		    N.x = (alpha * u.x + beta * v.x + gamma * w.x) / 
-			denominator;
-		    N.y = (alpha * u.y + beta * v.y + gamma * w.y) /
-			denominator;
-
-		    loopPosition(&N);
-		    getPixelTexture(triangle, &N, &c);
-		} else {
-		    getUntexturedDisplay(&c);
-		}
-		productColor(&c, &colorM, &c);
+	    // the texels of a sprite carry their color, lit already, and
+	    // their depth from the quad
+	    if (sprite) {
+		Position N;
+		float offset;
+		getPositionTriangle(A, B, C, &u, &v, &w, 
+				    alpha, beta, gamma, &N);
+		covered = getSpriteTexture(triangle, &N, &c, &offset);
+		depthM += offset;
+	    }
+	    if (covered && (zB[M.w + M.h * sW] < nearplan || 
+			    zB[M.w + M.h * sW] > depthM)) {
+		if (!sprite)
+		    shadeTriangle(triangle, level, A, B, C, &u, &v, &w,
+				  alpha, beta, gamma, &c);
 		translatePixel(l, &M, &c);
 		zB[M.w + M.h * sW] = depthM;
 	    }
@@ -213,3 +301,15 @@ void drawTriangle(Lens *l, Texture *triangle, Pixel *A, Pixel *B, Pixel *C)
 	}
     }
 }
+
+void getStatsDraw(long *triangles, long *pixels)
+{
+    *triangles = stats.triangles;
+    *pixels = stats.pixels;
+}
+
+void resetStatsDraw(void)
+{
+    stats.triangles = 0;
+    stats.pixels = 0;
+}
@@ -8,6 +8,9 @@
 #include "parametric.h"
 #include "hypergrid.h"
 
+// the points of the grid given at once to the equation
+#define CHUNK 4096
+
 typedef struct Grid {
     int grid[3];
 } Grid;
@@ -33,81 +36,80 @@ static int isInRange(int M[3], int lengths[3])
     return 1;
 }
 
-void setNormal(Solid *solid, int O, int A, int B, int **normalBuffer, 
+void setNormal(Mesh *mesh, int O, int A, int B, int **normalBuffer, 
 	       int dim, int *n, int side)
 {
     Point u, v, normal;
 
-    diffPoint(&solid->vertices[side ? B : A], &solid->vertices[O], &u);
-    diffPoint(&solid->vertices[side ? A : B], &solid->vertices[O], &v);
+    diffPoint(&mesh->vertices[side ? B : A], &mesh->vertices[O], &u);
+    diffPoint(&mesh->vertices[side ? A : B], &mesh->vertices[O], &v);
     pointProduct(&u, &v, &normal);
     normalizePoint(&normal, &normal);
 
     normalBuffer[O][dim] = *n;
-    solid->normals[*n] = normal;
+    mesh->normals[*n] = normal;
     (*n)++;
 }
 
-static void setPointFace(Solid *solid, int f, int a, int b, int c)
+static void setPointFace(Mesh *mesh, int f, int a, int b, int c)
 {
-    solid->faces[f].vertices[0].point = a;
-    solid->faces[f].vertices[1].point = b;
-    solid->faces[f].vertices[2].point = c;
+    mesh->faces[f].corners[0].point = a;
+    mesh->faces[f].corners[1].point = b;
+    mesh->faces[f].corners[2].point = c;
 }
 
-static void setPositionFace(Solid *solid, int f, int a, int b, int c)
+static void setPositionFace(Mesh *mesh, int f, int a, int b, int c)
 {
-    solid->faces[f].vertices[0].coord = a;
-    solid->faces[f].vertices[1].coord = b;
-    solid->faces[f].vertices[2].coord = c;
+    mesh->faces[f].corners[0].coord = a;
+    mesh->faces[f].corners[1].coord = b;
+    mesh->faces[f].corners[2].coord = c;
 }
 
-static void setNormalFace(Solid *solid, int f, int a, int b, int c)
+static void setNormalFace(Mesh *mesh, int f, int a, int b, int c)
 {
-    solid->faces[f].vertices[0].normal = a;
-    solid->faces[f].vertices[1].normal = b;
-    solid->faces[f].vertices[2].normal = c;
+    mesh->faces[f].corners[0].normal = a;
+    mesh->faces[f].corners[1].normal = b;
+    mesh->faces[f].corners[2].normal = c;
 }
 
-static void setTriangle(Solid *solid, int **normalBuffer, int dim, int f,
+static void setTriangle(Mesh *mesh, int **normalBuffer, int dim, int f,
 			int a, int b, int c, int A, int B, int C)
 {
-    setPointFace(solid, f, a, b, c);
-    setPositionFace(solid, f, A, B, C);
-    setNormalFace(solid, f, 
+    setPointFace(mesh, f, a, b, c);
+    setPositionFace(mesh, f, A, B, C);
+    setNormalFace(mesh, f, 
 		  normalBuffer[a][dim], 
 		  normalBuffer[b][dim], 
 		  normalBuffer[c][dim]);
 }
 
-static void setSquare(Solid *solid, int **normalBuffer, 
+static void setSquare(Mesh *mesh, int **normalBuffer, 
 		      int a, int b, int c, int d, int dim, int *f, int side)
 {
     if (side) {
-	setTriangle(solid, normalBuffer, dim, *f, a, b, c, 1, 3, 2);
+	setTriangle(mesh, normalBuffer, dim, *f, a, b, c, 1, 3, 2);
 	(*f)++;
-	setTriangle(solid, normalBuffer, dim, *f, a, c, d, 1, 2, 0);
+	setTriangle(mesh, normalBuffer, dim, *f, a, c, d, 1, 2, 0);
 	(*f)++;
     } else {
-	setTriangle(solid, normalBuffer, dim, *f, a, c, b, 1, 2, 3);
+	setTriangle(mesh, normalBuffer, dim, *f, a, c, b, 1, 2, 3);
 	(*f)++;
-	setTriangle(solid, normalBuffer, dim, *f, a, d, c, 1, 0, 2);
+	setTriangle(mesh, normalBuffer, dim, *f, a, d, c, 1, 0, 2);
 	(*f)++;
     }
  }      
 
-static void updateInput(float *input, float *min, float *interval, 
-			int *grid, int dim)
+static void updateGrid(int **grids, int k, int *grid, int nbInput, int dim)
 {
-    for (int i = 0; i < dim; i++)
-	input[i] = min[i] + interval[i] * grid[i];
+    for (int i = 0; i < nbInput; i++)
+	grids[i][k] = i < dim ? grid[i] : 0;
 }
 
-static void mapOutput(float *output, Point *A, int dim)
+static void mapOutput(float **outputs, int k, Point *A, int dim)
 {
-    A->x = dim >= 1 ? output[0] : 0;
-    A->y = dim >= 2 ? output[1] : 0;
-    A->z = dim >= 3 ? output[2] : 0;
+    A->x = dim >= 1 ? outputs[0][k] : 0;
+    A->y = dim >= 2 ? outputs[1][k] : 0;
+    A->z = dim >= 3 ? outputs[2][k] : 0;
 }
 
 Solid *loadEquation(const char *eqName, const char *bmpName)
@@ -122,10 +124,12 @@ Solid *loadEquation(const char *eqName, const char *bmpName)
 	return NULL;
     }
 
-    Solid *solid = malloc(sizeof(Solid));
-    float *input = malloc(nbInput * sizeof(float));
-    float *output = malloc(nbOutput * sizeof(float));
+    Solid *solid = calloc(1, sizeof(Solid));
+    Mesh mesh;
+    int **grids = malloc(nbInput * sizeof(int *));
+    float **outputs = malloc(nbOutput * sizeof(float *));
     float *interval = malloc(nbInput * sizeof(float));
+    int *axes = malloc(nbInput * sizeof(int));
     int dim = minimum(nbInput, 3);
 
     int lengths[3] = {1, 1, 1};
@@ -134,46 +138,54 @@ Solid *loadEquation(const char *eqName, const char *bmpName)
 
     int a, e = 0, n = 0, f = 0;
     for (int i = 0; i < nbInput; i++) {
-	input[i] = min[i];
+	grids[i] = malloc(CHUNK * sizeof(int));
 	interval[i] = (max[i] - min[i]) / (precision[i] - 1);
+	axes[i] = i < dim ? precision[i] : 1;
     } 
+    for (int i = 0; i < nbOutput; i++)
+	outputs[i] = malloc(CHUNK * sizeof(float));
+    initGridEquation(min, interval, axes);
 
-    solid->numVertices = getNumVertices(precision, dim);
-    solid->numSegments = getNumSegments(precision, dim);
-    solid->numCoords = 4;    
-    solid->numNormals = getNumNormals(precision, dim);
-    solid->numFaces = 2 * getNumFaces(precision, dim);
+    mesh.numVertices = getNumVertices(precision, dim);
+    mesh.numSegments = getNumSegments(precision, dim);
+    mesh.numCoords = 4;    
+    mesh.numNormals = getNumNormals(precision, dim);
+    mesh.numFaces = 2 * getNumFaces(precision, dim);
 
     if ((solid->texture = loadTexture(bmpName)))
 	printf("Texture successfully loaded\n");
     else
 	printf("Error loading texture\n");
 
-    solid->vertices = malloc(solid->numVertices * sizeof(Point));
-    solid->normals = malloc(solid->numNormals * sizeof(Point));
-    solid->segments = malloc(solid->numSegments * sizeof(Segment));
-    solid->faces = malloc(solid->numFaces * sizeof(Face));
-    solid->coords = malloc(solid->numCoords * sizeof(Position));
+    mesh.vertices = malloc(mesh.numVertices * sizeof(Point));
+    mesh.normals = malloc(mesh.numNormals * sizeof(Point));
+    mesh.segments = malloc(mesh.numSegments * sizeof(Segment));
+    mesh.faces = malloc(mesh.numFaces * sizeof(Face));
+    mesh.coords = malloc(mesh.numCoords * sizeof(Position));
 
-    Grid *gridBuffer = malloc(solid->numVertices * sizeof(Grid));
-    int **normalBuffer = malloc(solid->numVertices * sizeof(int *));
-    for (int i = 0; i < solid->numVertices; i++)
+    Grid *gridBuffer = malloc(mesh.numVertices * sizeof(Grid));
+    int **normalBuffer = malloc(mesh.numVertices * sizeof(int *));
+    for (int i = 0; i < mesh.numVertices; i++)
 	normalBuffer[i] = malloc(3 * sizeof(int));
 
-    setPosition(&solid->coords[0], 0., 0.);
-    setPosition(&solid->coords[1], 0., 1.);
-    setPosition(&solid->coords[2], 1., 0.);
-    setPosition(&solid->coords[3], 1., 1.);
-
-    for (a = 0; a < solid->numVertices; a++) {
-	getGridFromId(a, solid->numVertices, lengths, 
-		      gridBuffer[a].grid, 3);
-	updateInput(input, min, interval, gridBuffer[a].grid, dim);
-	getValueFromEquation(input, output);
-	mapOutput(output, &solid->vertices[a], nbOutput);
+    setPosition(&mesh.coords[0], 0., 0.);
+    setPosition(&mesh.coords[1], 0., 1.);
+    setPosition(&mesh.coords[2], 1., 0.);
+    setPosition(&mesh.coords[3], 1., 1.);
+
+    for (int first = 0; first < mesh.numVertices; first += CHUNK) {
+	int count = minimum(mesh.numVertices - first, CHUNK);
+	for (a = first; a < first + count; a++) {
+	    getGridFromId(a, mesh.numVertices, lengths, 
+			  gridBuffer[a].grid, 3);
+	    updateGrid(grids, a - first, gridBuffer[a].grid, nbInput, dim);
+	}
+	getGridValuesFromEquation(grids, outputs, count);
+	for (a = first; a < first + count; a++)
+	    mapOutput(outputs, a - first, &mesh.vertices[a], nbOutput);
     }
     
-    for (int i = 0; i < solid->numVertices; i++) {
+    for (int i = 0; i < mesh.numVertices; i++) {
 	int *O = gridBuffer[i].grid;
 	for (int j = 0; j < 3; j++) {
 	    int side = O[j] == 0;
@@ -189,7 +201,7 @@ Solid *loadEquation(const char *eqName, const char *bmpName)
 		int b = isInRange(B, lengths);
 
 		if (a && b) {
-		    setNormal(solid, i, 
+		    setNormal(&mesh, i, 
 			      getIdFromGrid(lengths, A, 3), 
 			      getIdFromGrid(lengths, B, 3), 
 			      normalBuffer, j, &n, side);
@@ -199,7 +211,7 @@ Solid *loadEquation(const char *eqName, const char *bmpName)
 		int c = isInRange(C, lengths);
 
 		if (b && c) {
-		    setNormal(solid, i, 
+		    setNormal(&mesh, i, 
 			      getIdFromGrid(lengths, B, 3),
 			      getIdFromGrid(lengths, C, 3), 
 			      normalBuffer, j, &n, side);
@@ -209,7 +221,7 @@ Solid *loadEquation(const char *eqName, const char *bmpName)
 		int d = isInRange(D, lengths);
 
 		if (c && d) {
-		    setNormal(solid, i, 
+		    setNormal(&mesh, i, 
 			      getIdFromGrid(lengths, C, 3),
 			      getIdFromGrid(lengths, D, 3), 
 			      normalBuffer, j, &n, side);
@@ -217,7 +229,7 @@ Solid *loadEquation(const char *eqName, const char *bmpName)
 		}
 
 		if (d && a) {
-		    setNormal(solid, i,
+		    setNormal(&mesh, i,
 			      getIdFromGrid(lengths, D, 3),
 			      getIdFromGrid(lengths, A, 3), 
 			      normalBuffer, j, &n, side);
@@ -226,12 +238,12 @@ Solid *loadEquation(const char *eqName, const char *bmpName)
 	    }
 	}
     }
-    for (a = 0; a < solid->numVertices; a++) {
+    for (a = 0; a < mesh.numVertices; a++) {
 	int delta = 1;
 	for (int i = 0; i < dim; i++) {
 	    if (gridBuffer[a].grid[i] < precision[i] - 1) {
-		solid->segments[e].A = a; 
-		solid->segments[e].B = a + delta; 
+		mesh.segments[e].A = a; 
+		mesh.segments[e].B = a + delta; 
 		e++;
 	    }
 	    delta *= precision[i];
@@ -250,7 +262,7 @@ Solid *loadEquation(const char *eqName, const char *bmpName)
 		int b = getIdFromGrid(precision, B, dim);
 		int c = getIdFromGrid(precision, C, dim);
 		int d = getIdFromGrid(precision, D, dim);
-		setSquare(solid, normalBuffer, a, b, c, d, i, &f, side);    
+		setSquare(&mesh, normalBuffer, a, b, c, d, i, &f, side);    
 	    }
 	}
     }
@@ -258,13 +270,19 @@ Solid *loadEquation(const char *eqName, const char *bmpName)
     free(max);
     free(precision);
     free(interval);
-    free(input);
-    free(output);
+    for (int i = 0; i < nbInput; i++)
+	free(grids[i]);
+    for (int i = 0; i < nbOutput; i++)
+	free(outputs[i]);
+    free(grids);
+    free(outputs);
+    free(axes);
     free(gridBuffer);
     freeEquation();
-    for (int i = 0; i < solid->numVertices; i++)
+    for (int i = 0; i < mesh.numVertices; i++)
 	free(normalBuffer[i]);
     free(normalBuffer);
+    weldBuild(solid, &mesh);
     printf("Equation successfully loaded\n");
     return solid;
 }
@@ -32,12 +32,14 @@ static int char_in(char c, const char *str)
 FILE *fopen(const char *path, const char *mode)
 {
     int fd;
-    int flags = 0;
+    int flags = O_RDONLY;
     if ( char_in('w', mode) )
-	flags &= O_CREAT;
+	flags = O_WRONLY | O_CREAT | O_TRUNC;
     if ( char_in('a', mode) )
-	flags &= O_APPEND;
-    if ((fd = openat(dir, path, flags)) == -1)
-	fd = open(path, flags);
+	flags = O_WRONLY | O_CREAT | O_APPEND;
+    if ( char_in('+', mode) )
+	flags = (flags & ~O_ACCMODE) | O_RDWR;
+    if ((fd = openat(dir, path, flags, 0666)) == -1)
+	fd = open(path, flags, 0666);
     return fdopen(fd, mode);
 }
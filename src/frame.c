@@ -40,5 +40,43 @@ void getAbsolutePointFromFrame(const Frame *f, const Point *A, Point *B)
 	     f->O.z + A->x * f->i.z + A->y * f->j.z + A->z * f->k.z);
 }
 
+// the axes need not be orthonormal, u is solved with their cofactors
+void getRelativeVectorFromFrame(const Frame *f, const Point *u, Point *v)
+{
+    Point jk, ki, ij;
+    pointProduct(&f->j, &f->k, &jk);
+    pointProduct(&f->k, &f->i, &ki);
+    pointProduct(&f->i, &f->j, &ij);
+    float det = scalarProduct(&f->i, &jk);
+    setPoint(v,
+	     scalarProduct(&jk, u) / det,
+	     scalarProduct(&ki, u) / det,
+	     scalarProduct(&ij, u) / det);
+}
+
+void getRelativePointFromFrame(const Frame *f, const Point *A, Point *B)
+{
+    Point OA;
+    diffPoint(A, &f->O, &OA);
+    getRelativeVectorFromFrame(f, &OA, B);
+}
+
+// the inverse transpose of the axes of f, which carries the normals,
+// scaled so that a rotation times a scale keeps their length
+void getNormalFrame(const Frame *f, Frame *n)
+{
+    setPoint(&n->O, 0., 0., 0.);
+    pointProduct(&f->j, &f->k, &n->i);
+    pointProduct(&f->k, &f->i, &n->j);
+    pointProduct(&f->i, &f->j, &n->k);
+    float det = scalarProduct(&f->i, &n->i);
+    if (det == 0.)
+	return;
+    float k = cbrtf(det) / det;
+    setPoint(&n->i, k * n->i.x, k * n->i.y, k * n->i.z);
+    setPoint(&n->j, k * n->j.x, k * n->j.y, k * n->j.z);
+    setPoint(&n->k, k * n->k.x, k * n->k.y, k * n->k.z);
+}
+
 
 
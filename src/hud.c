@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hud.h"
+#include "coord.h"
+#include "color.h"
+#include "display.h"
+#include "draw.h"
+#include "texture.h"
+
+#define GLYPHWIDTH 3
+#define GLYPHHEIGHT 5
+#define MAXSPANS (2 * GLYPHHEIGHT)
+#define NB_GLYPHS 128
+#define NB_SAMPLES 64
+#define NB_LINES 6
+#define LINELENGTH 32
+#define MARGIN 2
+#define GRAPHHEIGHT 32
+#define MEMORYPERIOD 1.
+
+// rows of a 3x5 font, most significant bit on the left
+static const char glyphChars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:/-";
+static const unsigned char glyphRows[][GLYPHHEIGHT] = {
+    {7, 5, 5, 5, 7}, {2, 6, 2, 2, 7}, {7, 1, 7, 4, 7}, {7, 1, 7, 1, 7},
+    {5, 5, 7, 1, 1}, {7, 4, 7, 1, 7}, {7, 4, 7, 5, 7}, {7, 1, 1, 1, 1},
+    {7, 5, 7, 5, 7}, {7, 5, 7, 1, 7}, {2, 5, 7, 5, 5}, {6, 5, 6, 5, 6},
+    {3, 4, 4, 4, 3}, {6, 5, 5, 5, 6}, {7, 4, 6, 4, 7}, {7, 4, 6, 4, 4},
+    {3, 4, 5, 5, 3}, {5, 5, 7, 5, 5}, {7, 2, 2, 2, 7}, {1, 1, 1, 5, 2},
+    {5, 5, 6, 5, 5}, {4, 4, 4, 4, 7}, {5, 7, 7, 5, 5}, {6, 5, 5, 5, 5},
+    {2, 5, 5, 5, 2}, {6, 5, 6, 4, 4}, {2, 5, 5, 6, 3}, {6, 5, 6, 5, 5},
+    {3, 4, 2, 1, 6}, {7, 2, 2, 2, 2}, {5, 5, 5, 5, 7}, {5, 5, 5, 5, 2},
+    {5, 5, 7, 7, 5}, {5, 5, 2, 5, 5}, {5, 5, 2, 2, 2}, {7, 1, 2, 4, 7},
+    {0, 0, 0, 0, 2}, {0, 2, 0, 2, 0}, {1, 1, 2, 4, 4}, {0, 0, 7, 0, 0}
+};
+
+typedef struct Span {
+    unsigned char row;
+    unsigned char start;
+    unsigned char length;
+} Span;
+
+typedef struct Glyph {
+    int nbSpans;
+    Span spans[MAXSPANS];
+} Glyph;
+
+static struct {
+    Glyph glyphs[NB_GLYPHS];
+    float frameTimes[NB_SAMPLES]; // ms spent in drawScene
+    int sample;
+    struct timespec frameStart;
+    struct timespec lastMemory;
+    float fps;
+    long triangles;
+    long pixels;
+    float memory; // MB resident
+    char lines[NB_LINES][LINELENGTH];
+} hud;
+
+static float elapsed(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) * 1e-9;
+}
+
+static void buildGlyph(Glyph *g, const unsigned char rows[GLYPHHEIGHT])
+{
+    g->nbSpans = 0;
+    for (int h = 0; h < GLYPHHEIGHT; h++) {
+	for (int w = 0; w < GLYPHWIDTH; w++) {
+	    if (!(rows[h] & (1 << (GLYPHWIDTH - 1 - w))))
+		continue;
+	    Span *s = &g->spans[g->nbSpans];
+	    if (g->nbSpans > 0 && s[-1].row == h && 
+		s[-1].start + s[-1].length == w) {
+		s[-1].length++;
+	    } else {
+		s->row = h;
+		s->start = w;
+		s->length = 1;
+		g->nbSpans++;
+	    }
+	}
+    }
+}
+
+static void readMemory(void)
+{
+    long size, resident;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file == NULL)
+	return;
+    if (fscanf(file, "%ld %ld", &size, &resident) == 2)
+	hud.memory = (float) resident * sysconf(_SC_PAGESIZE) / 
+	    (1024 * 1024);
+    fclose(file);
+}
+
+void initHud(void)
+{
+    memset(&hud, 0, sizeof(hud));
+    for (int i = 0; glyphChars[i]; i++)
+	buildGlyph(&hud.glyphs[(int) glyphChars[i]], glyphRows[i]);
+    clock_gettime(CLOCK_MONOTONIC, &hud.frameStart);
+    hud.lastMemory = hud.frameStart;
+    readMemory();
+}
+
+// called at the beginning of each frame, before anything is drawn
+void beginFrameHud(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    float dt = elapsed(&hud.frameStart, &now);
+    if (dt > 0.)
+	hud.fps = hud.fps * 0.9 + 0.1 / dt;
+    hud.frameStart = now;
+    if (elapsed(&hud.lastMemory, &now) >= MEMORYPERIOD) {
+	readMemory();
+	hud.lastMemory = now;
+    }
+    resetStatsDraw();
+}
+
+// called at the end of each frame, once the display has been blitted
+void endFrameHud(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    hud.frameTimes[hud.sample] = 1000. * elapsed(&hud.frameStart, &now);
+    hud.sample = (hud.sample + 1) % NB_SAMPLES;
+    getStatsDraw(&hud.triangles, &hud.pixels);
+}
+
+static void fillRect(int w, int h, int width, int height, const Color *color)
+{
+    Coord M;
+    for (M.h = h; M.h < h + height; M.h++)
+	for (M.w = w; M.w < w + width; M.w++)
+	    setPixelDisplay(&M, color);
+}
+
+static void drawText(const char *text, int w, int h, int scale, 
+		     const Color *color)
+{
+    for (; *text; text++, w += (GLYPHWIDTH + 1) * scale) {
+	const Glyph *g = &hud.glyphs[*text & (NB_GLYPHS - 1)];
+	for (int i = 0; i < g->nbSpans; i++)
+	    fillRect(w + g->spans[i].start * scale,
+		     h + g->spans[i].row * scale,
+		     g->spans[i].length * scale, scale, color);
+    }
+}
+
+static void drawGraph(int w, int h, int scale)
+{
+    Color bar, limit;
+    setColor(&bar, 0, 255, 0);
+    setColor(&limit, 255, 0, 0);
+    // one pixel per millisecond, the red line marks 60 fps
+    for (int i = 0; i < NB_SAMPLES; i++) {
+	float t = hud.frameTimes[(hud.sample + i) % NB_SAMPLES];
+	int height = t < GRAPHHEIGHT ? t : GRAPHHEIGHT;
+	fillRect(w + i * scale, h + (GRAPHHEIGHT - height) * scale, 
+		 scale, height * scale, &bar);
+    }
+    fillRect(w, h + (GRAPHHEIGHT - 16) * scale, NB_SAMPLES * scale, 1, 
+	     &limit);
+}
+
+// shows the figures of the last complete frame
+void drawHud(void)
+{
+    Color background, foreground;
+    int scale = getWidthDisplay() >= 640 ? 2 : 1;
+    int lineHeight = (GLYPHHEIGHT + 1) * scale;
+    int width = NB_SAMPLES * scale + 2 * MARGIN;
+    int height = NB_LINES * lineHeight + GRAPHHEIGHT * scale + 3 * MARGIN;
+
+    snprintf(hud.lines[0], LINELENGTH, "FPS %.1f", hud.fps);
+    snprintf(hud.lines[1], LINELENGTH, "MS %.2f", 
+	     hud.frameTimes[(hud.sample + NB_SAMPLES - 1) % NB_SAMPLES]);
+    snprintf(hud.lines[2], LINELENGTH, "TRI %ld", hud.triangles);
+    snprintf(hud.lines[3], LINELENGTH, "PIX %ld", hud.pixels);
+    snprintf(hud.lines[4], LINELENGTH, "MEM %.1fMB", hud.memory);
+    snprintf(hud.lines[5], LINELENGTH, "TEX %.1fMB", 
+	     getMemoryTexture() / (1024. * 1024.));
+
+    setColor(&background, 0, 0, 0);
+    setColor(&foreground, 255, 255, 255);
+    fillRect(0, 0, width, height, &background);
+    for (int i = 0; i < NB_LINES; i++)
+	drawText(hud.lines[i], MARGIN, MARGIN + i * lineHeight, scale, 
+		 &foreground);
+    drawGraph(MARGIN, 2 * MARGIN + NB_LINES * lineHeight, scale);
+}
@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "image.h"
+#include "mapping.h"
+
+// pixels are read in place from the mapped file: nothing is copied until
+// the caller converts them
+enum {INDEXED, GREY, RGB, BGR, BGRX, BGRA};
+
+typedef struct Image {
+    const char *data;
+    size_t size;
+    int width;
+    int height;
+    int format;
+    const uint8_t *pixels; // first row displayed on top
+    long stride; // negative for images stored bottom-up
+    const uint8_t *palette; // BGRA entries of indexed bitmaps
+    int nbColors;
+} Image;
+
+static inline uint16_t readShort(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static inline uint32_t readInt(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+// the rows start at offset and fit in the file, without overflowing on
+// large dimensions
+static int fitRows(const Image *image, size_t offset, long stride, 
+		   size_t size)
+{
+    return offset <= size && 
+	(size_t) stride <= (size - offset) / image->height;
+}
+
+static void setRows(Image *image, const uint8_t *first, long stride, 
+		    int bottomUp)
+{
+    if (bottomUp) {
+	image->pixels = first + (image->height - 1) * stride;
+	image->stride = -stride;
+    } else {
+	image->pixels = first;
+	image->stride = stride;
+    }
+}
+
+static int parseBMP(Image *image, const uint8_t *d, size_t size)
+{
+    if (size < 54 || d[0] != 'B' || d[1] != 'M')
+	return 0;
+    uint32_t offset = readInt(d + 10);
+    uint32_t header = readInt(d + 14);
+    int32_t height = readInt(d + 22);
+    int bpp = readShort(d + 28);
+    uint32_t compression = readInt(d + 30);
+    uint32_t nbColors = readInt(d + 46);
+
+    image->width = (int32_t) readInt(d + 18);
+    image->height = height < 0 ? -(long) height : height;
+    if (image->width <= 0 || image->height <= 0)
+	return 0;
+    if (header < 40 || compression != 0) {
+	fprintf(stderr, "Unsupported bitmap: compressed or old header\n");
+	return 0;
+    }
+    switch (bpp) {
+    case 8:
+	image->format = INDEXED;
+	image->nbColors = nbColors ? nbColors : 256;
+	image->palette = d + 14 + header;
+	if (image->nbColors > 256 || header > size || 
+	    14 + (size_t) header + 4 * image->nbColors > size)
+	    return 0;
+	break;
+    case 24:
+	image->format = BGR;
+	break;
+    case 32:
+	image->format = BGRX;
+	break;
+    default:
+	fprintf(stderr, "Unsupported bitmap: %d bits per pixel\n", bpp);
+	return 0;
+    }
+    long stride = ((long) image->width * bpp + 31) / 32 * 4;
+    if (!fitRows(image, offset, stride, size))
+	return 0;
+    setRows(image, d + offset, stride, height > 0);
+    return 1;
+}
+
+static int parseTGA(Image *image, const uint8_t *d, size_t size)
+{
+    if (size < 18 || d[1] != 0 || (d[2] != 2 && d[2] != 3))
+	return 0;
+    int bpp = d[16];
+    image->width = readShort(d + 12);
+    image->height = readShort(d + 14);
+    if (image->width == 0 || image->height == 0)
+	return 0;
+    if (d[2] == 3 && bpp == 8)
+	image->format = GREY;
+    else if (d[2] == 2 && bpp == 24)
+	image->format = BGR;
+    else if (d[2] == 2 && bpp == 32)
+	image->format = BGRA;
+    else
+	return 0;
+    long stride = (long) image->width * bpp / 8;
+    size_t offset = 18 + d[0];
+    if (!fitRows(image, offset, stride, size))
+	return 0;
+    setRows(image, d + offset, stride, !(d[17] & 0x20));
+    return 1;
+}
+
+static const uint8_t *skipSpacesPPM(const uint8_t *p, const uint8_t *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || 
+		       *p == '\r' || *p == '#')) {
+	if (*p == '#')
+	    while (p < end && *p != '\n')
+		p++;
+	else
+	    p++;
+    }
+    return p;
+}
+
+static const uint8_t *readIntPPM(const uint8_t *p, const uint8_t *end, 
+				 int *n)
+{
+    p = skipSpacesPPM(p, end);
+    *n = 0;
+    if (p >= end || *p < '0' || *p > '9')
+	return NULL;
+    while (p < end && *p >= '0' && *p <= '9') {
+	if (*n > (INT_MAX - 9) / 10)
+	    return NULL;
+	*n = 10 * *n + *p++ - '0';
+    }
+    return p;
+}
+
+static int parsePPM(Image *image, const uint8_t *d, size_t size)
+{
+    const uint8_t *end = d + size;
+    const uint8_t *p = d + 2;
+    int maxValue;
+    if (size < 8 || d[0] != 'P' || (d[1] != '5' && d[1] != '6'))
+	return 0;
+    if (!(p = readIntPPM(p, end, &image->width)) ||
+	!(p = readIntPPM(p, end, &image->height)) ||
+	!(p = readIntPPM(p, end, &maxValue)) || maxValue != 255 ||
+	image->width <= 0 || image->height <= 0) {
+	fprintf(stderr, "Unsupported pixmap header\n");
+	return 0;
+    }
+    p++; // single whitespace before the raster
+    image->format = d[1] == '5' ? GREY : RGB;
+    long stride = (long) image->width * (image->format == GREY ? 1 : 3);
+    if (!fitRows(image, p - d, stride, size))
+	return 0;
+    setRows(image, p, stride, 0);
+    return 1;
+}
+
+Image *loadImage(const char *fileName)
+{
+    if (!fileName)
+	return NULL;
+    Image *image = malloc(sizeof(Image));
+    if (!(image->data = mapFile(fileName, &image->size))) {
+	perror(fileName);
+	free(image);
+	return NULL;
+    }
+    const uint8_t *d = (const uint8_t *) image->data;
+    // targa files have no signature and are tried last
+    if (!parseBMP(image, d, image->size) && 
+	!parsePPM(image, d, image->size) &&
+	!parseTGA(image, d, image->size)) {
+	fprintf(stderr, "%s: unknown or invalid image format\n", fileName);
+	freeImage(image);
+	return NULL;
+    }
+    return image;
+}
+
+int getWidthImage(const Image *image)
+{
+    return image->width;
+}
+
+int getHeightImage(const Image *image)
+{
+    return image->height;
+}
+
+// RGBA8 value of the pixel, red in the low byte
+uint32_t getPixelImage(const Image *image, int w, int h)
+{
+    const uint8_t *row = image->pixels + h * image->stride;
+    const uint8_t *p;
+    switch (image->format) {
+    case INDEXED:
+	if (row[w] >= image->nbColors)
+	    return 0xFFu << 24;
+	p = image->palette + 4 * row[w];
+	return p[2] | p[1] << 8 | p[0] << 16 | 0xFFu << 24;
+    case GREY:
+	return row[w] * 0x010101u | 0xFFu << 24;
+    case RGB:
+	p = row + 3 * w;
+	return p[0] | p[1] << 8 | p[2] << 16 | 0xFFu << 24;
+    case BGR:
+	p = row + 3 * w;
+	return p[2] | p[1] << 8 | p[0] << 16 | 0xFFu << 24;
+    case BGRX:
+	p = row + 4 * w;
+	return p[2] | p[1] << 8 | p[0] << 16 | 0xFFu << 24;
+    default:
+	p = row + 4 * w;
+	return p[2] | p[1] << 8 | p[0] << 16 | (uint32_t) p[3] << 24;
+    }
+}
+
+void freeImage(Image *image)
+{
+    if (image) {
+	unmapFile(image->data, image->size);
+	free(image);
+    }
+}
@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "point.h"
+#include "color.h"
+#include "frame.h"
+#include "lens.h"
+#include "texture.h"
+#include "project.h"
+#include "impostor.h"
+
+// the turn of the view and the change of distance over which the sprite
+// is drawn again
+#define MAXANGLE 0.05
+#define MAXZOOM 0.1
+
+// the solid as seen from eye, drawn on a quad facing eye through center
+struct Impostor {
+    Lens *lens;
+    Texture *sprite;
+    int size;
+    int valid;
+    Point direction;
+    float distance;
+    // top left, top right, bottom left and bottom right
+    Point corners[4];
+    Frame model;
+    Color tint;
+};
+
+Impostor *initImpostor(void)
+{
+    Impostor *im = malloc(sizeof(Impostor));
+    im->lens = initTargetLens();
+    im->sprite = NULL;
+    im->size = 0;
+    im->valid = 0;
+    return im;
+}
+
+// the sprite still stands for the solid seen from eye
+int isValidImpostor(const Impostor *im, const Point *eye, 
+		    const Point *center, const Frame *model, 
+		    const Color *tint, int size)
+{
+    if (!im->valid || im->size < size || 
+	memcmp(&im->model, model, sizeof(Frame)) ||
+	im->tint.r != tint->r || im->tint.g != tint->g || 
+	im->tint.b != tint->b)
+	return 0;
+    Point d;
+    diffPoint(center, eye, &d);
+    float distance = normPoint(&d);
+    return fabsf(distance - im->distance) < MAXZOOM * im->distance &&
+	scalarProduct(&d, &im->direction) > cosf(MAXANGLE) * distance;
+}
+
+// the lens through which the solid is to be drawn, looking from the eye
+// of l at center with about the same up axis
+Lens *beginImpostor(Impostor *im, Lens *l, const Point *center, 
+		    float radius, int size, const Frame *model, 
+		    const Color *tint)
+{
+    const Frame *p = getPosition(l);
+    Frame *q = getPosition(im->lens);
+    Point d, u;
+    diffPoint(center, &p->O, &d);
+    im->distance = normPoint(&d);
+    normalizePoint(&d, &q->j);
+
+    setPoint(&u, 
+	     p->k.x - scalarProduct(&p->k, &q->j) * q->j.x,
+	     p->k.y - scalarProduct(&p->k, &q->j) * q->j.y,
+	     p->k.z - scalarProduct(&p->k, &q->j) * q->j.z);
+    normalizePoint(&u, &q->k);
+    setPoint(&u, 
+	     p->i.x - scalarProduct(&p->i, &q->j) * q->j.x - 
+	     scalarProduct(&p->i, &q->k) * q->k.x,
+	     p->i.y - scalarProduct(&p->i, &q->j) * q->j.y - 
+	     scalarProduct(&p->i, &q->k) * q->k.y,
+	     p->i.z - scalarProduct(&p->i, &q->j) * q->j.z - 
+	     scalarProduct(&p->i, &q->k) * q->k.z);
+    normalizePoint(&u, &q->i);
+    q->O = p->O;
+
+    float angle = asinf(fminf(radius / im->distance, 0.99));
+    float e = im->distance * tanf(angle);
+    setTargetLens(im->lens, size, size, 2. * angle, getNearplan(l));
+    resetLens(im->lens);
+    for (int c = 0; c < 4; c++) {
+	float x = c & 1 ? e : -e;
+	float y = c & 2 ? -e : e;
+	setPoint(&im->corners[c], 
+		 center->x + x * q->i.x + y * q->k.x,
+		 center->y + x * q->i.y + y * q->k.y,
+		 center->z + x * q->i.z + y * q->k.z);
+    }
+    im->direction = q->j;
+    im->size = size;
+    im->model = *model;
+    im->tint = *tint;
+    return im->lens;
+}
+
+// the pixels drawn become the sprite, with their depth from the quad
+void endImpostor(Impostor *im)
+{
+    int n = im->size * im->size;
+    float *zB = getZBuffer(im->lens);
+    float nearplan = getNearplan(im->lens);
+    float *offsets = malloc(n * sizeof(float));
+    for (int i = 0; i < n; i++)
+	offsets[i] = zB[i] < nearplan ? INFINITY : zB[i] - im->distance;
+    freeTexture(im->sprite);
+    im->sprite = initSpriteTexture(im->size, im->size);
+    setSpriteTexture(im->sprite, getTarget(im->lens), offsets);
+    free(offsets);
+    im->valid = 1;
+}
+
+void drawImpostor(Lens *l, Impostor *im)
+{
+    Position U[4];
+    setPosition(&U[0], 0., 0.);
+    setPosition(&U[1], 1., 0.);
+    setPosition(&U[2], 0., 1.);
+    setPosition(&U[3], 1., 1.);
+    const Point *A = im->corners;
+    projectSprite(l, &A[0], &A[2], &A[1], im->sprite, &U[0], &U[2], &U[1]);
+    projectSprite(l, &A[1], &A[2], &A[3], im->sprite, &U[1], &U[2], &U[3]);
+}
+
+void freeImpostor(Impostor *im)
+{
+    if (im == NULL)
+	return;
+    freeLens(im->lens);
+    freeTexture(im->sprite);
+    free(im);
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "point.h"
+#include "color.h"
+#include "frame.h"
+#include "solid.h"
+#include "buffer.h"
+#include "instance.h"
+#include "impostor.h"
+
+#define MAXLENSES 8
+
+struct Instance {
+    Solid *solid;
+    // from the coordinates of the solid to the scene
+    Frame model;
+    Color tint;
+    Point origin;
+    // the level of detail last drawn on each lens
+    int lods[MAXLENSES];
+    // made the first time the instance is drawn far on a lens
+    Impostor *impostors[MAXLENSES];
+};
+
+// a solid loaded once for all the instances of the same files
+typedef struct Shared {
+    char *fileName;
+    char *bmpName;
+    Solid *solid;
+    int count;
+} Shared;
+
+static struct {
+    Shared **sharedBuffer;
+    int nbShared;
+    int sharedSize;
+} registry;
+
+static int isSameName(const char *a, const char *b)
+{
+    return strcmp(a ? a : "", b ? b : "") == 0;
+}
+
+static Solid *acquireSolid(const char *fileName, const char *bmpName)
+{
+    for (int i = 0; i < registry.nbShared; i++) {
+	Shared *s = registry.sharedBuffer[i];
+	if (isSameName(s->fileName, fileName) && 
+	    isSameName(s->bmpName, bmpName)) {
+	    s->count++;
+	    return s->solid;
+	}
+    }
+    Solid *solid = loadSolid(fileName, bmpName);
+    if (solid == NULL)
+	return NULL;
+    Shared *s = malloc(sizeof(Shared));
+    s->fileName = strdup(fileName);
+    s->bmpName = bmpName ? strdup(bmpName) : NULL;
+    s->solid = solid;
+    s->count = 1;
+    if (registry.sharedBuffer == NULL) {
+	registry.sharedSize = 4;
+	registry.sharedBuffer = malloc(registry.sharedSize * sizeof(Shared*));
+    }
+    addElementToBuffer(s, &registry.sharedBuffer, 
+		       &registry.sharedSize, &registry.nbShared);
+    return solid;
+}
+
+static void releaseSolid(Solid *solid)
+{
+    for (int i = 0; i < registry.nbShared; i++) {
+	Shared *s = registry.sharedBuffer[i];
+	if (s->solid != solid || --s->count > 0)
+	    continue;
+	freeSolid(s->solid);
+	free(s->fileName);
+	free(s->bmpName);
+	free(s);
+	registry.sharedBuffer[i] = 
+	    registry.sharedBuffer[--registry.nbShared];
+	break;
+    }
+    if (registry.nbShared == 0) {
+	free(registry.sharedBuffer);
+	registry.sharedBuffer = NULL;
+    }
+}
+
+Instance *loadInstance(const char *fileName, const char *bmpName)
+{
+    Solid *solid = acquireSolid(fileName, bmpName);
+    if (solid == NULL)
+	return NULL;
+    Instance *instance = malloc(sizeof(Instance));
+    instance->solid = solid;
+    initFrame(&instance->model);
+    setColor(&instance->tint, 255, 255, 255);
+    instance->origin = *getOriginSolid(solid);
+    memset(instance->lods, 0, sizeof(instance->lods));
+    memset(instance->impostors, 0, sizeof(instance->impostors));
+    return instance;
+}
+
+Solid *getSolidInstance(Instance *instance)
+{
+    return instance->solid;
+}
+
+Frame *getModelInstance(Instance *instance)
+{
+    return &instance->model;
+}
+
+Point *getOriginInstance(Instance *instance)
+{
+    return &instance->origin;
+}
+
+Color *getTintInstance(Instance *instance)
+{
+    return &instance->tint;
+}
+
+void setTintInstance(Instance *instance, const Color *tint)
+{
+    instance->tint = *tint;
+}
+
+// the lenses past MAXLENSES keep no level and start from the full solid
+int getLodInstance(Instance *instance, int lens)
+{
+    return lens < MAXLENSES ? instance->lods[lens] : 0;
+}
+
+void setLodInstance(Instance *instance, int lens, int lod)
+{
+    if (lens < MAXLENSES)
+	instance->lods[lens] = lod;
+}
+
+Impostor *getImpostorInstance(Instance *instance, int lens)
+{
+    if (lens >= MAXLENSES)
+	return NULL;
+    if (instance->impostors[lens] == NULL)
+	instance->impostors[lens] = initImpostor();
+    return instance->impostors[lens];
+}
+
+// the transforms are composed into the model: its origin moves as a
+// point, its axes turn and scale as vectors
+void translateInstance(Instance *instance, float x, float y, float z)
+{
+    translatePoint(&instance->model.O, x, y, z);
+    translatePoint(&instance->origin, x, y, z);
+}
+
+void scaleInstance(Instance *instance, const Point *O, float scale)
+{
+    Point zero;
+    setPoint(&zero, 0., 0., 0.);
+    scalePoint(&instance->model.O, O, scale);
+    scalePoint(&instance->model.i, &zero, scale);
+    scalePoint(&instance->model.j, &zero, scale);
+    scalePoint(&instance->model.k, &zero, scale);
+    scalePoint(&instance->origin, O, scale);
+}
+
+static void rotModelInstance(Instance *instance, const Point *O, float angle,
+			     void (*rot)(Point *, const Point *, float))
+{
+    Point zero;
+    setPoint(&zero, 0., 0., 0.);
+    rot(&instance->model.O, O, angle);
+    rot(&instance->model.i, &zero, angle);
+    rot(&instance->model.j, &zero, angle);
+    rot(&instance->model.k, &zero, angle);
+    rot(&instance->origin, O, angle);
+}
+
+void rotInstanceXAxis(Instance *instance, const Point *O, float phi)
+{
+    rotModelInstance(instance, O, phi, rotPointXAxis);
+}
+
+void rotInstanceYAxis(Instance *instance, const Point *O, float rho)
+{
+    rotModelInstance(instance, O, rho, rotPointYAxis);
+}
+
+void rotInstanceZAxis(Instance *instance, const Point *O, float theta)
+{
+    rotModelInstance(instance, O, theta, rotPointZAxis);
+}
+
+// the solid is freed with its last instance
+void freeInstance(Instance *instance)
+{
+    releaseSolid(instance->solid);
+    for (int i = 0; i < MAXLENSES; i++)
+	freeImpostor(instance->impostors[i]);
+    free(instance);
+}
@@ -33,6 +33,8 @@ typedef struct {
     int screenHeight; //Relative
     int overlapping;
     float *zBuffer;
+    // the pixels go there instead of the display when set
+    Color *target;
     float nearplan;
     float farplan;
     float wfov; //Absolute
@@ -140,9 +142,38 @@ Lens *initLens(char *fileName)
     }
     initFrame(&l->position);
     l->zBuffer = NULL;
+    l->target = NULL;
     return l;
 }
 
+// a lens drawing into its own buffer, sized by setTargetLens
+Lens *initTargetLens(void)
+{
+    Lens *l = malloc(sizeof(Lens));
+    loadDefaultLens(l);
+    l->widthPositionA = 0;
+    l->heightPositionA = 0;
+    l->screenWidthA = 0;
+    l->screenHeightA = 0;
+    initFrame(&l->position);
+    l->zBuffer = NULL;
+    l->target = NULL;
+    return l;
+}
+
+// the field of view is fov both ways
+void setTargetLens(Lens *l, int width, int height, float fov, 
+		   float nearplan)
+{
+    l->screenWidthA = width;
+    l->screenHeightA = height;
+    l->wfov = fov;
+    l->hfov = fov;
+    l->nearplan = nearplan;
+    l->zBuffer = realloc(l->zBuffer, sizeof(float) * width * height);
+    l->target = realloc(l->target, sizeof(Color) * width * height);
+}
+
 void resetLens(Lens *l)
 {
     memset(l->zBuffer, 0, sizeof(float) * l->screenWidthA * l->screenHeightA);
@@ -178,6 +209,11 @@ float *getZBuffer(Lens *l)
     return l->zBuffer;
 }
 
+Color *getTarget(Lens *l)
+{
+    return l->target;
+}
+
 Color *getFilter(Lens *l)
 {
     return &l->filter;
@@ -236,5 +272,6 @@ int getOverlapping(Lens *l)
 void freeLens(Lens *l)
 {
     free(l->zBuffer);
+    free(l->target);
     free(l);
 }
@@ -0,0 +1,541 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "point.h"
+#include "build.h"
+#include "lod.h"
+
+#define MAXLODS 8
+// the coarsest level keeps about as many faces
+#define MINFACES 64
+// the cosine under which a collapse turns a face too far
+#define MINCOSINE 0.2
+#define MAXPAIRS 16
+#define NONE -1
+
+// the sum of the squared distances to the planes of the faces around a
+// point, each weighted by the area of its face
+typedef struct Quadric {
+    double a[10];
+    double weight;
+} Quadric;
+
+// the point from moved onto the point to; stamp tells whether the
+// quadrics changed since the cost was computed
+typedef struct Collapse {
+    float cost;
+    int from;
+    int to;
+    int stamp;
+    int reversed;
+} Collapse;
+
+typedef struct Heap {
+    Collapse *items;
+    int count;
+    int size;
+} Heap;
+
+// the faces around a point, in the shared array until it grows
+typedef struct Fan {
+    int *faces;
+    int count;
+    int size;
+    int owned;
+} Fan;
+
+typedef struct Simplifier {
+    int numPoints;
+    int numFaces;
+    int alive;
+    Point *positions;
+    Quadric *quadrics;
+    int *stamps;
+    char *removed;
+    // the points around the last collapse are marked with its number
+    int *marks;
+    int numCollapses;
+    // 3 per face, the points and the vertices as collapsed so far
+    int *corners;
+    int *vertices;
+    char *dead;
+    Fan *fans;
+    int *fanFaces;
+    Heap heap;
+} Simplifier;
+
+static void addPlaneQuadric(Quadric *q, const Point *n, double d,
+			    double weight)
+{
+    double a = n->x, b = n->y, c = n->z;
+    double plane[10] = {a * a, a * b, a * c, a * d, b * b, b * c, b * d,
+			c * c, c * d, d * d};
+    for (int i = 0; i < 10; i++)
+	q->a[i] += weight * plane[i];
+    q->weight += weight;
+}
+
+static void sumQuadric(const Quadric *p, const Quadric *q, Quadric *s)
+{
+    for (int i = 0; i < 10; i++)
+	s->a[i] = p->a[i] + q->a[i];
+    s->weight = p->weight + q->weight;
+}
+
+// the mean distance from P to the planes of the quadric
+static float evalQuadric(const Quadric *q, const Point *P)
+{
+    double x = P->x, y = P->y, z = P->z;
+    const double *a = q->a;
+    double e = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z +
+	2 * a[3] * x + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y +
+	a[7] * z * z + 2 * a[8] * z + a[9];
+    return q->weight > 0. && e > 0. ? sqrt(e / q->weight) : 0.;
+}
+
+static void pushHeap(Heap *h, const Collapse *c)
+{
+    if (h->count == h->size) {
+	h->size = h->size ? 2 * h->size : 256;
+	h->items = realloc(h->items, h->size * sizeof(Collapse));
+    }
+    int i = h->count++;
+    for (; i > 0 && h->items[(i - 1) / 2].cost > c->cost; i = (i - 1) / 2)
+	h->items[i] = h->items[(i - 1) / 2];
+    h->items[i] = *c;
+}
+
+static void popHeap(Heap *h, Collapse *c)
+{
+    *c = h->items[0];
+    Collapse last = h->items[--h->count];
+    int i = 0;
+    for (;;) {
+	int child = 2 * i + 1;
+	if (child >= h->count)
+	    break;
+	if (child + 1 < h->count &&
+	    h->items[child + 1].cost < h->items[child].cost)
+	    child++;
+	if (h->items[child].cost >= last.cost)
+	    break;
+	h->items[i] = h->items[child];
+	i = child;
+    }
+    if (h->count > 0)
+	h->items[i] = last;
+}
+
+static void addFan(Fan *fan, int face)
+{
+    if (fan->count == fan->size) {
+	fan->size = fan->size ? 2 * fan->size : 8;
+	int *faces = malloc(fan->size * sizeof(int));
+	memcpy(faces, fan->faces, fan->count * sizeof(int));
+	if (fan->owned)
+	    free(fan->faces);
+	fan->faces = faces;
+	fan->owned = 1;
+    }
+    fan->faces[fan->count++] = face;
+}
+
+static int hasPoint(const Simplifier *s, int f, int p)
+{
+    const int *c = &s->corners[3 * f];
+    return c[0] == p || c[1] == p || c[2] == p;
+}
+
+static void getFaceNormal(const Simplifier *s, int f, int from,
+			  const Point *moved, Point *n)
+{
+    const Point *P[3];
+    for (int k = 0; k < 3; k++) {
+	int p = s->corners[3 * f + k];
+	P[k] = p == from ? moved : &s->positions[p];
+    }
+    Point AB, AC;
+    diffPoint(P[1], P[0], &AB);
+    diffPoint(P[2], P[0], &AC);
+    pointProduct(&AB, &AC, n);
+}
+
+static float getCost(const Simplifier *s, int from, int to)
+{
+    Quadric q;
+    sumQuadric(&s->quadrics[from], &s->quadrics[to], &q);
+    return evalQuadric(&q, &s->positions[to]);
+}
+
+// the edge is collapsed onto whichever end moves the surface the least
+static void pushEdge(Simplifier *s, int A, int B)
+{
+    Collapse c;
+    float costA = getCost(s, A, B);
+    float costB = getCost(s, B, A);
+    c.from = costA <= costB ? A : B;
+    c.to = costA <= costB ? B : A;
+    c.cost = fminf(costA, costB);
+    c.stamp = s->stamps[A] + s->stamps[B];
+    c.reversed = 0;
+    pushHeap(&s->heap, &c);
+}
+
+static void initSimplifier(Simplifier *s, Solid *solid)
+{
+    int numFaces = solid->numFaces;
+    s->numPoints = 0;
+    for (int v = 0; v < solid->numVertices; v++)
+	if (solid->points[v] >= s->numPoints)
+	    s->numPoints = solid->points[v] + 1;
+    s->numFaces = numFaces;
+    s->positions = malloc((s->numPoints + 1) * sizeof(Point));
+    s->quadrics = calloc(s->numPoints + 1, sizeof(Quadric));
+    s->stamps = calloc(s->numPoints + 1, sizeof(int));
+    s->removed = calloc(s->numPoints + 1, 1);
+    s->marks = calloc(s->numPoints + 1, sizeof(int));
+    s->numCollapses = 0;
+    s->corners = malloc((3 * numFaces + 1) * sizeof(int));
+    s->vertices = malloc((3 * numFaces + 1) * sizeof(int));
+    s->dead = calloc(numFaces + 1, 1);
+    s->fans = calloc(s->numPoints + 1, sizeof(Fan));
+    s->fanFaces = malloc((3 * numFaces + 1) * sizeof(int));
+    memset(&s->heap, 0, sizeof(Heap));
+
+    for (int v = 0; v < solid->numVertices; v++)
+	s->positions[solid->points[v]] = solid->vertices[v].point;
+    for (int i = 0; i < 3 * numFaces; i++) {
+	s->vertices[i] = getIndexBuild(solid, i);
+	s->corners[i] = solid->points[s->vertices[i]];
+    }
+
+    // the faces with a point twice are left out of the coarser levels
+    s->alive = 0;
+    for (int f = 0; f < numFaces; f++) {
+	const int *c = &s->corners[3 * f];
+	s->dead[f] = c[0] == c[1] || c[1] == c[2] || c[2] == c[0];
+	if (s->dead[f])
+	    continue;
+	s->alive++;
+	for (int k = 0; k < 3; k++)
+	    s->fans[c[k]].size++;
+    }
+    int offset = 0;
+    for (int p = 0; p < s->numPoints; p++) {
+	s->fans[p].faces = &s->fanFaces[offset];
+	offset += s->fans[p].size;
+    }
+    for (int f = 0; f < numFaces; f++)
+	if (!s->dead[f])
+	    for (int k = 0; k < 3; k++)
+		addFan(&s->fans[s->corners[3 * f + k]], f);
+}
+
+static void setQuadrics(Simplifier *s, Solid *solid)
+{
+    for (int f = 0; f < s->numFaces; f++) {
+	if (s->dead[f])
+	    continue;
+	Point n, u;
+	getFaceNormal(s, f, NONE, NULL, &n);
+	float area = normPoint(&n);
+	if (area == 0.)
+	    continue;
+	normalizePoint(&n, &u);
+	double d = -scalarProduct(&u, &s->positions[s->corners[3 * f]]);
+	for (int k = 0; k < 3; k++)
+	    addPlaneQuadric(&s->quadrics[s->corners[3 * f + k]], &u, d,
+			    area / 2.);
+    }
+
+    // the borders are held by planes across them
+    int linked = solid->halfEdges != NULL;
+    if (!linked)
+	linkHalfEdgeBuild(solid);
+    for (int h = 0; h < 3 * s->numFaces; h++) {
+	if (solid->halfEdges[h].twin != NONE || s->dead[h / 3])
+	    continue;
+	int A = s->corners[h];
+	int B = s->corners[h - h % 3 + (h + 1) % 3];
+	Point n, AB, across, u;
+	getFaceNormal(s, h / 3, NONE, NULL, &n);
+	diffPoint(&s->positions[B], &s->positions[A], &AB);
+	pointProduct(&AB, &n, &across);
+	float length = normPoint(&across);
+	if (length == 0.)
+	    continue;
+	normalizePoint(&across, &u);
+	double d = -scalarProduct(&u, &s->positions[A]);
+	double weight = scalarProduct(&AB, &AB);
+	addPlaneQuadric(&s->quadrics[A], &u, d, weight);
+	addPlaneQuadric(&s->quadrics[B], &u, d, weight);
+    }
+    if (!linked) {
+	free(solid->halfEdges);
+	solid->halfEdges = NULL;
+    }
+}
+
+// the faces around from must not fold over once it sits on to
+static int isFlipping(const Simplifier *s, int from, int to)
+{
+    const Fan *fan = &s->fans[from];
+    for (int i = 0; i < fan->count; i++) {
+	int f = fan->faces[i];
+	if (s->dead[f] || hasPoint(s, f, to))
+	    continue;
+	Point before, after;
+	getFaceNormal(s, f, NONE, NULL, &before);
+	getFaceNormal(s, f, from, &s->positions[to], &after);
+	if (scalarProduct(&before, &after) <=
+	    MINCOSINE * normPoint(&before) * normPoint(&after))
+	    return 1;
+    }
+    return 0;
+}
+
+// the faces with the edge go, the others around from take on to and
+// the vertex of to next to the one of from they had
+static void collapse(Simplifier *s, int from, int to)
+{
+    Fan *fan = &s->fans[from];
+    int pairs[MAXPAIRS][2];
+    int nbPairs = 0;
+    for (int i = 0; i < fan->count; i++) {
+	int f = fan->faces[i];
+	if (s->dead[f] || !hasPoint(s, f, to))
+	    continue;
+	int vFrom = NONE, vTo = NONE;
+	for (int k = 0; k < 3; k++) {
+	    if (s->corners[3 * f + k] == from)
+		vFrom = s->vertices[3 * f + k];
+	    if (s->corners[3 * f + k] == to)
+		vTo = s->vertices[3 * f + k];
+	}
+	if (nbPairs < MAXPAIRS) {
+	    pairs[nbPairs][0] = vFrom;
+	    pairs[nbPairs++][1] = vTo;
+	}
+	s->dead[f] = 1;
+	s->alive--;
+    }
+    for (int i = 0; i < fan->count; i++) {
+	int f = fan->faces[i];
+	if (s->dead[f])
+	    continue;
+	for (int k = 0; k < 3; k++) {
+	    if (s->corners[3 * f + k] != from)
+		continue;
+	    int v = pairs[0][1];
+	    for (int j = 0; j < nbPairs; j++)
+		if (pairs[j][0] == s->vertices[3 * f + k])
+		    v = pairs[j][1];
+	    s->corners[3 * f + k] = to;
+	    s->vertices[3 * f + k] = v;
+	}
+	addFan(&s->fans[to], f);
+    }
+    s->removed[from] = 1;
+    sumQuadric(&s->quadrics[from], &s->quadrics[to], &s->quadrics[to]);
+    s->stamps[to]++;
+    s->numCollapses++;
+
+    Fan *toFan = &s->fans[to];
+    int count = 0;
+    for (int i = 0; i < toFan->count; i++)
+	if (!s->dead[toFan->faces[i]])
+	    toFan->faces[count++] = toFan->faces[i];
+    toFan->count = count;
+    for (int i = 0; i < toFan->count; i++) {
+	int f = toFan->faces[i];
+	for (int k = 0; k < 3; k++) {
+	    int p = s->corners[3 * f + k];
+	    if (p != to && s->marks[p] != s->numCollapses) {
+		s->marks[p] = s->numCollapses;
+		pushEdge(s, p, to);
+	    }
+	}
+    }
+}
+
+// the cheapest collapse still possible, 0 when none is left
+static int collapseNext(Simplifier *s, float *error)
+{
+    while (s->heap.count > 0) {
+	Collapse c;
+	popHeap(&s->heap, &c);
+	if (s->removed[c.from] || s->removed[c.to] ||
+	    c.stamp != s->stamps[c.from] + s->stamps[c.to])
+	    continue;
+	int shared = 0;
+	const Fan *fan = &s->fans[c.from];
+	for (int i = 0; i < fan->count && !shared; i++)
+	    shared = !s->dead[fan->faces[i]] &&
+		hasPoint(s, fan->faces[i], c.to);
+	if (!shared)
+	    continue;
+	if (isFlipping(s, c.from, c.to)) {
+	    // the other way round, once
+	    if (!c.reversed) {
+		Collapse r = {getCost(s, c.to, c.from), c.to, c.from,
+			      c.stamp, 1};
+		pushHeap(&s->heap, &r);
+	    }
+	    continue;
+	}
+	*error = fmaxf(*error, c.cost);
+	collapse(s, c.from, c.to);
+	return 1;
+    }
+    return 0;
+}
+
+static void freeSimplifier(Simplifier *s)
+{
+    for (int p = 0; p < s->numPoints; p++)
+	if (s->fans[p].owned)
+	    free(s->fans[p].faces);
+    free(s->fans);
+    free(s->fanFaces);
+    free(s->heap.items);
+    free(s->positions);
+    free(s->quadrics);
+    free(s->stamps);
+    free(s->removed);
+    free(s->marks);
+    free(s->corners);
+    free(s->vertices);
+    free(s->dead);
+}
+
+// the vertices are sorted by the coarsest level using them, so each
+// level draws a prefix of them; those a level adds keep the order in
+// which its faces first fetch them
+static void sortVertices(Solid *solid, const int *levels, uint32_t *indices,
+			 int numIndices)
+{
+    int n = solid->numVertices;
+    int counts[MAXLODS + 1] = {0};
+    for (int v = 0; v < n; v++)
+	counts[levels[v]]++;
+    int starts[MAXLODS + 1];
+    int start = 0;
+    for (int k = MAXLODS; k >= 0; k--) {
+	starts[k] = start;
+	start += counts[k];
+    }
+    for (int k = 0; k < solid->numLods; k++) {
+	solid->lods[k].numVertices = 0;
+	for (int j = k; j <= MAXLODS; j++)
+	    solid->lods[k].numVertices += counts[j];
+    }
+
+    int *numbers = malloc((n + 1) * sizeof(int));
+    Vertex *vertices = malloc((n + 1) * sizeof(Vertex));
+    int *points = malloc((n + 1) * sizeof(int));
+    for (int v = 0; v < n; v++)
+	numbers[v] = -1;
+    // a vertex is first used by the coarsest level using it
+    for (int k = solid->numLods - 1; k >= 0; k--) {
+	const Lod *lod = &solid->lods[k];
+	for (int i = 3 * lod->firstFace; 
+	     i < 3 * (lod->firstFace + lod->numFaces); i++)
+	    if (numbers[indices[i]] < 0)
+		numbers[indices[i]] = starts[levels[indices[i]]]++;
+    }
+    // then the vertices used by no face
+    for (int v = 0; v < n; v++)
+	if (numbers[v] < 0)
+	    numbers[v] = starts[levels[v]]++;
+    for (int v = 0; v < n; v++) {
+	vertices[numbers[v]] = solid->vertices[v];
+	points[numbers[v]] = solid->points[v];
+    }
+    for (int i = 0; i < numIndices; i++)
+	indices[i] = numbers[indices[i]];
+    for (int i = 0; i < solid->numSegments; i++) {
+	solid->segments[i].A = numbers[solid->segments[i].A];
+	solid->segments[i].B = numbers[solid->segments[i].B];
+    }
+    free(solid->vertices);
+    free(solid->points);
+    solid->vertices = vertices;
+    solid->points = points;
+    free(numbers);
+}
+
+static void setIndices(Solid *solid, const uint32_t *indices,
+		       int numIndices)
+{
+    free(solid->indices);
+    solid->indices = malloc((numIndices + 1) * solid->indexSize);
+    for (int i = 0; i < numIndices; i++) {
+	if (solid->indexSize == sizeof(uint16_t))
+	    ((uint16_t *) solid->indices)[i] = indices[i];
+	else
+	    ((uint32_t *) solid->indices)[i] = indices[i];
+    }
+}
+
+// the faces are halved from one level to the next by collapsing the
+// edges which move the surface the least, after Garland and Heckbert
+void simplifyLod(Solid *solid)
+{
+    if (solid->numFaces < 2 * MINFACES || solid->vertices == NULL)
+	return;
+    Simplifier s;
+    initSimplifier(&s, solid);
+    setQuadrics(&s, solid);
+    for (int f = 0; f < s.numFaces; f++)
+	if (!s.dead[f])
+	    for (int k = 0; k < 3; k++)
+		if (s.corners[3 * f + k] < s.corners[3 * f + (k + 1) % 3])
+		    pushEdge(&s, s.corners[3 * f + k],
+			     s.corners[3 * f + (k + 1) % 3]);
+
+    int numIndices = 3 * solid->numFaces;
+    uint32_t *indices = malloc((2 * numIndices + 1) * sizeof(uint32_t));
+    int *levels = calloc(solid->numVertices + 1, sizeof(int));
+    Lod lods[MAXLODS];
+    for (int i = 0; i < numIndices; i++)
+	indices[i] = getIndexBuild(solid, i);
+    lods[0].firstFace = 0;
+    lods[0].numFaces = solid->numFaces;
+    lods[0].error = 0.;
+    int numLods = 1;
+    float error = 0.;
+    int target = s.alive / 2;
+
+    while (numLods < MAXLODS && target >= MINFACES &&
+	   collapseNext(&s, &error)) {
+	if (s.alive > target)
+	    continue;
+	Lod *lod = &lods[numLods];
+	lod->firstFace = numIndices / 3;
+	lod->numFaces = s.alive;
+	lod->error = error;
+	for (int f = 0; f < s.numFaces; f++) {
+	    if (s.dead[f])
+		continue;
+	    for (int k = 0; k < 3; k++) {
+		int v = s.vertices[3 * f + k];
+		indices[numIndices++] = v;
+		levels[v] = numLods;
+	    }
+	}
+	numLods++;
+	target = s.alive / 2;
+    }
+    freeSimplifier(&s);
+
+    if (numLods > 1) {
+	solid->numLods = numLods;
+	solid->lods = malloc(numLods * sizeof(Lod));
+	memcpy(solid->lods, lods, numLods * sizeof(Lod));
+	sortVertices(solid, levels, indices, numIndices);
+	setIndices(solid, indices, numIndices);
+    }
+    free(levels);
+    free(indices);
+}
@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mapping.h"
+
+// the file is opened through fopen so that paths relative to the
+// executable keep working
+static void *mapFileProtection(const char *fileName, size_t *size, int prot)
+{
+    struct stat st;
+    FILE *file = fopen(fileName, "r");
+    if (file == NULL)
+	return NULL;
+    if (fstat(fileno(file), &st) == -1 || st.st_size == 0) {
+	fclose(file);
+	return NULL;
+    }
+    void *data = mmap(NULL, st.st_size, prot, MAP_PRIVATE, fileno(file), 0);
+    fclose(file);
+    if (data == MAP_FAILED)
+	return NULL;
+    *size = st.st_size;
+    return data;
+}
+
+const char *mapFile(const char *fileName, size_t *size)
+{
+    return mapFileProtection(fileName, size, PROT_READ);
+}
+
+// the pages are copied when written, the file is left untouched
+char *mapCopyFile(const char *fileName, size_t *size)
+{
+    return mapFileProtection(fileName, size, PROT_READ | PROT_WRITE);
+}
+
+void unmapFile(const char *data, size_t size)
+{
+    if (data)
+	munmap((void *) data, size);
+}
@@ -42,6 +42,9 @@ static void handleMouseButtonDownEvent(SDL_Event *event)
     case SDL_BUTTON_RIGHT:
 	state.rightClickDown = 1;
 	break;
+    case SDL_BUTTON_LEFT:
+	pickScene(event->button.x, event->button.y);
+	break;
     case SDL_BUTTON_WHEELUP:
 	translateCameraScene(FORWARD);
 	break;
@@ -115,6 +118,12 @@ static void handleKeyUpEvent(SDL_Event *event)
    case SDLK_f:
 	switchStateCameraScene(FRAME);
 	break;
+    case SDLK_h:
+	switchStateCameraScene(HUD);
+	break;
+    case SDLK_c:
+	switchStateCameraScene(SILHOUETTE);
+	break;
     case SDLK_l:
 	askSolidForScene();
 	break;
@@ -74,6 +74,12 @@ void handleEvent_(int *stop)
 	case 'f':
 	    switchStateCameraScene(FRAME);
 	    break;
+	case 'h':
+	    switchStateCameraScene(HUD);
+	    break;
+	case 'c':
+	    switchStateCameraScene(SILHOUETTE);
+	    break;
 	case 'l':
 	    clear();
 	    refresh();
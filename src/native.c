@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+
+#include "native.h"
+
+#define MAXLENGTH 256
+#define HASHSYMBOL "nativeHash"
+#define CACHEDIRECTORY "3Displayer"
+#define FLAGS "-O2 -march=native -fPIC -shared -w"
+
+static uint64_t hashString(uint64_t hash, const char *s)
+{
+    for (; *s; s++)
+	hash = (hash ^ (unsigned char) *s) * 1099511628211ULL;
+    return hash;
+}
+
+// the processor the code is tuned for by -march=native, from the fields
+// of its first entry that do not change while it runs
+static uint64_t hashTarget(uint64_t hash)
+{
+    static const char *fields[] = {
+	"vendor_id", "cpu family", "model", "model name", "flags", "Features", 
+	"CPU implementer", "CPU architecture", "CPU variant", "CPU part"
+    };
+    char line[4096];
+    FILE *file = fopen("/proc/cpuinfo", "r");
+    if (file == NULL)
+	return hash;
+    while (fgets(line, sizeof(line), file) && line[0] != '\n') {
+	for (int i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+	    size_t length = strlen(fields[i]);
+	    if (strncmp(line, fields[i], length) == 0 && 
+		(line[length] == '\t' || line[length] == ':'))
+		hash = hashString(hash, line);
+	}
+    }
+    fclose(file);
+    return hash;
+}
+
+// a directory of the user that only the user can write to, where the
+// libraries are built and loaded from
+static int getCacheDirectory(char *directory)
+{
+    char base[MAXLENGTH];
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    struct stat st;
+
+    if (xdg != NULL && xdg[0] == '/')
+	snprintf(base, MAXLENGTH, "%s", xdg);
+    else if (home != NULL && home[0] == '/')
+	snprintf(base, MAXLENGTH, "%s/.cache", home);
+    else {
+	fprintf(stderr, "No cache directory: neither XDG_CACHE_HOME nor "
+		"HOME is an absolute path\n");
+	return 0;
+    }
+    mkdir(base, 0700);
+    if (snprintf(directory, MAXLENGTH, "%s/" CACHEDIRECTORY, base) >= 
+	MAXLENGTH) {
+	fprintf(stderr, "Cache directory name too long: %s\n", base);
+	return 0;
+    }
+    mkdir(directory, 0700);
+    if (lstat(directory, &st) != 0) {
+	perror(directory);
+	return 0;
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || 
+	(st.st_mode & 077) != 0) {
+	fprintf(stderr, "%s: not a directory that only the user can "
+		"access\n", directory);
+	return 0;
+    }
+    return 1;
+}
+
+// a library built before for the same hash
+static void *openCached(const char *fileName, uint64_t hash)
+{
+    void *native = dlopen(fileName, RTLD_NOW | RTLD_LOCAL);
+    if (native == NULL)
+	return NULL;
+    const uint64_t *h = dlsym(native, HASHSYMBOL);
+    if (h != NULL && *h == hash)
+	return native;
+    dlclose(native);
+    return NULL;
+}
+
+// the library is built under a temporary name then renamed, so that
+// another process never loads it half written
+static int buildLibrary(const char *fileName, const char *source, 
+			const char *cc, uint64_t hash)
+{
+    char sourceName[MAXLENGTH], tempName[MAXLENGTH];
+    char command[4 * MAXLENGTH];
+    int pid = getpid();
+
+    if (strchr(fileName, '\'') || strchr(cc, '\'') ||
+	snprintf(sourceName, MAXLENGTH, "%s.%d.c", fileName, pid) >= 
+	MAXLENGTH || 
+	snprintf(tempName, MAXLENGTH, "%s.%d", fileName, pid) >= 
+	MAXLENGTH || 
+	snprintf(command, 4 * MAXLENGTH, "'%s' " FLAGS " -o '%s' '%s' "
+		 "2>/dev/null", cc, tempName, sourceName) >= 4 * MAXLENGTH)
+	return 0;
+
+    FILE *file = fopen(sourceName, "w");
+    if (file == NULL)
+	return 0;
+    fprintf(file, "%s\nconst unsigned long long %s = %lluULL;\n", 
+	    source, HASHSYMBOL, (unsigned long long) hash);
+    int ok = fclose(file) == 0 && system(command) == 0;
+    remove(sourceName);
+
+    if (ok && rename(tempName, fileName) == 0)
+	return 1;
+    remove(tempName);
+    return 0;
+}
+
+// source compiled by the system compiler into a library of the cache
+// directory, named after the source, the compiler and the processor, and
+// reused for as long as they stay the same; NULL, with the reason on
+// stderr, when the source can't be compiled, e.g. without a compiler
+void *openNative(const char *source)
+{
+    char directory[MAXLENGTH], libraryName[MAXLENGTH];
+    const char *cc = getenv("CC") ? getenv("CC") : "cc";
+    uint64_t hash = 14695981039346656037ULL;
+    hash = hashString(hash, cc);
+    hash = hashString(hash, FLAGS);
+    hash = hashTarget(hash);
+    hash = hashString(hash, source);
+    if (!getCacheDirectory(directory))
+	return NULL;
+    if (snprintf(libraryName, MAXLENGTH, "%s/%016llx.so", directory, 
+		 (unsigned long long) hash) >= MAXLENGTH) {
+	fprintf(stderr, "Cache directory name too long: %s\n", directory);
+	return NULL;
+    }
+
+    void *native = openCached(libraryName, hash);
+    if (native == NULL && !buildLibrary(libraryName, source, cc, hash)) {
+	fprintf(stderr, "Error compiling %s with %s\n", libraryName, cc);
+	return NULL;
+    }
+    if (native == NULL && (native = openCached(libraryName, hash)) == NULL)
+	fprintf(stderr, "Error loading %s\n", libraryName);
+    return native;
+}
+
+void *getNative(void *native, const char *symbol)
+{
+    return dlsym(native, symbol);
+}
+
+void closeNative(void *native)
+{
+    dlclose(native);
+}
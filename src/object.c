@@ -1,187 +1,473 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "build.h"
 #include "point.h"
 #include "position.h"
 #include "texture.h"
+#include "mapping.h"
 
-#define MAXLENGTH 256
+#define MISSING -1
+#define MAXMANTISSA 100000000000000000ULL
+#define MAXRELATIVE (1 << 29)
+#define RELATIVE (-2 * MAXRELATIVE)
+#define CHUNKSIZE (4 << 20)
+#define MAXCHUNKS 256
+#define MAXTHREADS 64
 
-Solid *loadObject(const char *fileName, const char *bmpName)
+// a part of the file parsed on its own, its indices are fixed afterwards
+typedef struct Chunk {
+    const char *begin;
+    const char *end;
+    Mesh part;
+    int vertexSize, normalSize, coordSize, faceSize;
+    int lines;
+    const char *error;
+    int outOfRange;
+    Corner offset;
+    int faceOffset;
+} Chunk;
+
+typedef struct Work {
+    Chunk *chunks;
+    int nbChunks;
+    int next;
+    Mesh *mesh;
+    void (*run)(Chunk *, Mesh *);
+} Work;
+
+static const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline int isDigit(char c)
 {
-    FILE *file = fopen(fileName, "r");
-    if (file == NULL) {
-	perror(fileName);
-        return NULL;
-    }
+    return c >= '0' && c <= '9';
+}
+
+static inline int isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char *skipSpaces(const char *p, const char *end)
+{
+    while (p < end && isSpace(*p))
+	p++;
+    return p;
+}
+
+static const char *skipLine(const char *p, const char *end)
+{
+    const char *eol = memchr(p, '\n', end - p);
+    return eol ? eol + 1 : end;
+}
+
+static int isKeyword(const char *p, const char *end, const char *keyword)
+{
+    for (; *keyword; keyword++, p++)
+	if (p >= end || *p != *keyword)
+	    return 0;
+    return p < end && isSpace(*p);
+}
 
-    int a = 0, b = 0, c = 0, d = 0, n, stock, bufferSize = 1;
-    Solid *solid = malloc(sizeof(Solid));
-    char str[MAXLENGTH] = {0};
-    char f;
-    
-    solid->numVertices = 0;
-    solid->numNormals = 0;
-    solid->numCoords = 0;
-    solid->numSegments = 0;
-    solid->numFaces = 0;
-  
-    while (fscanf(file, "%s", str) != EOF) {
-	if (strcmp(str, "v") == 0)
-	    solid->numVertices++;
-	else if (strcmp(str, "vn") == 0)
-	    solid->numNormals++;
-	else if (strcmp(str, "vt") == 0)
-	    solid->numCoords++;
-	else if (strcmp(str, "f") == 0) {
-	    n = 0;
-	    while (fscanf(file, "%c", &f) != EOF && f != '\n') {
-		if (f == '/')
-		    n++;
+static const char *parseInt(const char *p, const char *end, int *n)
+{
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+'))
+	negative = *p++ == '-';
+    if (p >= end || !isDigit(*p))
+	return NULL;
+    for (*n = 0; p < end && isDigit(*p); p++)
+	*n = 10 * *n + *p - '0';
+    if (negative)
+	*n = -*n;
+    return p;
+}
+
+// digits are accumulated in an integer mantissa and scaled once
+static const char *parseFloat(const char *p, const char *end, float *x)
+{
+    unsigned long long mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    int negative = 0;
+
+    p = skipSpaces(p, end);
+    if (p < end && (*p == '-' || *p == '+'))
+	negative = *p++ == '-';
+    for (; p < end && isDigit(*p); p++, digits++) {
+	if (mantissa < MAXMANTISSA)
+	    mantissa = 10 * mantissa + *p - '0';
+	else
+	    exponent++;
+    }
+    if (p < end && *p == '.') {
+	for (p++; p < end && isDigit(*p); p++, digits++) {
+	    if (mantissa < MAXMANTISSA) {
+		mantissa = 10 * mantissa + *p - '0';
+		exponent--;
 	    }
-	    solid->numFaces += n / 2 - 2;
 	}
     }
-    solid->vertices = (Point*) malloc(solid->numVertices * sizeof(Point));
-    solid->normals = (Point*) malloc(solid->numNormals * sizeof(Point));
-    solid->coords = (Position*) malloc(solid->numCoords * sizeof(Position));
-    solid->segments = (Segment*) malloc(bufferSize * sizeof(Segment));
-    solid->faces = (Face *) malloc(solid->numFaces * sizeof(Face));
- 
-    if((solid->texture = loadTexture(bmpName)))
-	printf("Texture successfully loaded\n");
-    else
-	printf("Error loading texture\n");
+    if (digits == 0)
+	return NULL;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+	int e;
+	if (!(p = parseInt(p + 1, end, &e)))
+	    return NULL;
+	exponent += e;
+    }
 
-    rewind(file);
-    while (fscanf(file, "%s", str) != EOF) {
-	if (strcmp(str, "v") == 0) {
-	    if (fscanf
-		(file, "%f %f %f\n", 
-		 &solid->vertices[a].y,
-		 &solid->vertices[a].z, 
-		 &solid->vertices[a].x) != 3) {
-		fprintf(stderr, "Error loading vertices\n");
-		free(solid);
-		fclose(file);
-		return NULL;
-	    }
-	    a++;
-	} else if (strcmp(str, "vn") == 0) {
-	    if (fscanf
-		(file, "%f %f %f\n", 
-		 &solid->normals[b].y,
-		 &solid->normals[b].z, 
-		 &solid->normals[b].x) != 3) {
-		fprintf(stderr, "Error loading normals\n");
-		free(solid);
-		fclose(file);
+    double value = mantissa;
+    if (exponent < 0)
+	value = -exponent <= 22 ? 
+	    value / powersOfTen[-exponent] : value * pow(10., exponent);
+    else if (exponent > 0)
+	value = exponent <= 22 ? 
+	    value * powersOfTen[exponent] : value * pow(10., exponent);
+    *x = negative ? -value : value;
+    return p;
+}
+
+static void *growArray(void *array, int count, int *size, size_t dataSize)
+{
+    if (count >= *size) {
+	*size = *size ? 2 * *size : 64;
+	array = realloc(array, *size * dataSize);
+    }
+    return array;
+}
+
+// OBJ indices start at 1, negative ones are relative to the last element:
+// they are kept relative to the chunk until its offset is known
+static int resolveIndex(int index, int count)
+{
+    return index < 0 ? RELATIVE + count + index : index - 1;
+}
+
+static int isValidIndex(int index)
+{
+    return index != 0 && index > -MAXRELATIVE;
+}
+
+static int fixIndex(int *index, int offset)
+{
+    if (*index < MISSING)
+	*index += offset - RELATIVE;
+    return *index >= 0;
+}
+
+// v, v/vt, v//vn or v/vt/vn
+static const char *parseCorner(const char *p, const char *end, 
+			       const Mesh *mesh, Corner *v)
+{
+    int index;
+    v->coord = MISSING;
+    v->normal = MISSING;
+    if (!(p = parseInt(p, end, &index)) || !isValidIndex(index))
+	return NULL;
+    v->point = resolveIndex(index, mesh->numVertices);
+    if (p < end && *p == '/') {
+	p++;
+	if (p < end && *p != '/') {
+	    if (!(p = parseInt(p, end, &index)) || !isValidIndex(index))
 		return NULL;
-	    }
-	    b++;
-	} else if (strcmp(str, "vt") == 0) {
-	    if (fscanf
-		(file, "%f %f\n", 
-		 &solid->coords[c].x,
-		 &solid->coords[c].y) != 2) {
-		fprintf(stderr, "Error loading texture coordinates\n");
-		free(solid);
-		fclose(file);
+	    v->coord = resolveIndex(index, mesh->numCoords);
+	}
+	if (p < end && *p == '/') {
+	    if (!(p = parseInt(p + 1, end, &index)) || !isValidIndex(index))
 		return NULL;
+	    v->normal = resolveIndex(index, mesh->numNormals);
+	}
+    }
+    return p;
+}
+
+static const char *parseFace(const char *p, const char *end, Mesh *mesh, 
+			     int *faceSize)
+{
+    Corner first, previous, current;
+    int n = 0;
+    while ((p = skipSpaces(p, end)) < end && *p != '\n' && *p != '#') {
+	if (!(p = parseCorner(p, end, mesh, &current)))
+	    return NULL;
+	if (n == 0) {
+	    first = current;
+	} else if (n >= 2) {
+	    mesh->faces = growArray(mesh->faces, mesh->numFaces, 
+				    faceSize, sizeof(Face));
+	    Face *f = &mesh->faces[mesh->numFaces++];
+	    f->corners[0] = first;
+	    f->corners[1] = previous;
+	    f->corners[2] = current;
+	}
+	previous = current;
+	n++;
+    }
+    return n >= 3 ? p : NULL;
+}
+
+static int addDefaultCoord(Mesh *mesh)
+{
+    mesh->coords = realloc(mesh->coords, 
+			   (mesh->numCoords + 1) * sizeof(Position));
+    setPosition(&mesh->coords[mesh->numCoords], 0., 0.);
+    return mesh->numCoords++;
+}
+
+// faces without normal get their geometric normal
+static int addFaceNormal(Mesh *mesh, const Face *f, int *normalSize)
+{
+    mesh->normals = growArray(mesh->normals, mesh->numNormals, 
+			      normalSize, sizeof(Point));
+    normal(&mesh->vertices[f->corners[0].point],
+	   &mesh->vertices[f->corners[1].point],
+	   &mesh->vertices[f->corners[2].point],
+	   &mesh->normals[mesh->numNormals]);
+    return mesh->numNormals++;
+}
+
+// checks the indices and fills the missing ones
+static int finishObject(Mesh *mesh, int *normalSize)
+{
+    int defaultCoord = MISSING;
+
+    for (int i = 0; i < mesh->numFaces; i++) {
+	Face *f = &mesh->faces[i];
+	int faceNormal = MISSING;
+	for (int k = 0; k < 3; k++) {
+	    Corner *v = &f->corners[k];
+	    if (v->point >= mesh->numVertices || 
+		v->coord >= mesh->numCoords ||
+		v->normal >= mesh->numNormals)
+		return 0;
+	}
+	for (int k = 0; k < 3; k++) {
+	    Corner *v = &f->corners[k];
+	    if (v->coord == MISSING) {
+		if (defaultCoord == MISSING)
+		    defaultCoord = addDefaultCoord(mesh);
+		v->coord = defaultCoord;
 	    }
-	    solid->coords[c].y = 1 - solid->coords[c].y;
-	    c++;
-	} else if (strcmp(str, "f") == 0) {
-
-	    stock = d;
-
-	    if (fscanf(file, "%d/%d/%d", 
-		       &solid->faces[d].vertices[0].point,
-		       &solid->faces[d].vertices[0].coord,
-		       &solid->faces[d].vertices[0].normal) != 3 || 
-		fscanf(file, "%d/%d/%d",
-		       &solid->faces[d].vertices[1].point,
-		       &solid->faces[d].vertices[1].coord,
-		       &solid->faces[d].vertices[1].normal) != 3 || 
-		fscanf(file, "%d/%d/%d",
-		       &solid->faces[d].vertices[2].point,
-		       &solid->faces[d].vertices[2].coord,
-		       &solid->faces[d].vertices[2].normal) != 3) {
-		fprintf(stderr, "Error during faces enumeration\n");
-		free(solid);
-		fclose(file);
-		return NULL;
+	    if (v->normal == MISSING) {
+		if (faceNormal == MISSING)
+		    faceNormal = addFaceNormal(mesh, f, normalSize);
+		v->normal = faceNormal;
 	    }
+	}
+    }
+    return 1;
+}
 
-	    solid->faces[d].vertices[0].point--;
-	    solid->faces[d].vertices[0].coord--;
-	    solid->faces[d].vertices[0].normal--;
-	    solid->faces[d].vertices[1].point--;
-	    solid->faces[d].vertices[1].coord--;
-	    solid->faces[d].vertices[1].normal--;
-	    solid->faces[d].vertices[2].point--;
-	    solid->faces[d].vertices[2].coord--;
-	    solid->faces[d].vertices[2].normal--;
-	    
-	    Segment u;
-	    setSegmentBuild(&u, 
-			    solid->faces[d].vertices[0].point,
-			    solid->faces[d].vertices[1].point);
-	    addSegmentBuild(solid, &u, &bufferSize);
-	    setSegmentBuild(&u, 
-			    solid->faces[d].vertices[1].point,
-			    solid->faces[d].vertices[2].point);
-	    addSegmentBuild(solid, &u, &bufferSize);
-	    setSegmentBuild(&u, 
-			    solid->faces[d].vertices[2].point,
-			    solid->faces[d].vertices[0].point);
-	    addSegmentBuild(solid, &u, &bufferSize);
-	    
-
-	    d++;
-
-	    while (fscanf(file, "%d/%d/%d", 
-			  &solid->faces[d].vertices[2].point,
-			  &solid->faces[d].vertices[2].coord,
-			  &solid->faces[d].vertices[2].normal) == 3) {
-		solid->faces[d].vertices[0].point =
-		    solid->faces[stock].vertices[0].point;
-		solid->faces[d].vertices[0].coord =
-		    solid->faces[stock].vertices[0].coord;
-		solid->faces[d].vertices[0].normal =
-		    solid->faces[stock].vertices[0].normal;
-
-		solid->faces[d].vertices[1].point =
-		    solid->faces[d - 1].vertices[2].point;
-		solid->faces[d].vertices[1].coord =
-		    solid->faces[d - 1].vertices[2].coord;
-		solid->faces[d].vertices[1].normal =
-		    solid->faces[d - 1].vertices[2].normal;
-
-		solid->faces[d].vertices[2].point--;
-		solid->faces[d].vertices[2].coord--;
-		solid->faces[d].vertices[2].normal--;
-
-		setSegmentBuild(&u, 
-				solid->faces[d].vertices[1].point,
-				solid->faces[d].vertices[2].point);
-		addSegmentBuild(solid, &u, &bufferSize);
-
-		setSegmentBuild(&u, 
-				solid->faces[d].vertices[2].point,
-				solid->faces[d].vertices[0].point);
-		addSegmentBuild(solid, &u, &bufferSize);
-
-		d++;
+static void parseChunk(Chunk *c, Mesh *mesh)
+{
+    Mesh *part = &c->part;
+    const char *end = c->end;
+    const char *p = c->begin;
+
+    while (p < end) {
+	p = skipSpaces(p, end);
+	if (isKeyword(p, end, "v")) {
+	    part->vertices = growArray(part->vertices, part->numVertices,
+				       &c->vertexSize, sizeof(Point));
+	    Point *A = &part->vertices[part->numVertices++];
+	    if (!(p = parseFloat(p + 1, end, &A->y)) ||
+		!(p = parseFloat(p, end, &A->z)) ||
+		!(p = parseFloat(p, end, &A->x))) {
+		c->error = "Error loading vertices";
+		return;
+	    }
+	} else if (isKeyword(p, end, "vn")) {
+	    part->normals = growArray(part->normals, part->numNormals,
+				      &c->normalSize, sizeof(Point));
+	    Point *n = &part->normals[part->numNormals++];
+	    if (!(p = parseFloat(p + 2, end, &n->y)) ||
+		!(p = parseFloat(p, end, &n->z)) ||
+		!(p = parseFloat(p, end, &n->x))) {
+		c->error = "Error loading normals";
+		return;
 	    }
+	} else if (isKeyword(p, end, "vt")) {
+	    part->coords = growArray(part->coords, part->numCoords,
+				     &c->coordSize, sizeof(Position));
+	    Position *t = &part->coords[part->numCoords++];
+	    if (!(p = parseFloat(p + 2, end, &t->x)) ||
+		!(p = parseFloat(p, end, &t->y))) {
+		c->error = "Error loading texture coordinates";
+		return;
+	    }
+	    t->y = 1 - t->y;
+	} else if (isKeyword(p, end, "f")) {
+	    if (!(p = parseFace(p + 1, end, part, &c->faceSize))) {
+		c->error = "Error during faces enumeration";
+		return;
+	    }
+	}
+	p = skipLine(p, end);
+	c->lines++;
+    }
+}
+
+// copies the chunk at its offsets, making its relative indices absolute
+static void scatterChunk(Chunk *c, Mesh *mesh)
+{
+    Mesh *part = &c->part;
+    memcpy(mesh->vertices + c->offset.point, part->vertices, 
+	   part->numVertices * sizeof(Point));
+    memcpy(mesh->normals + c->offset.normal, part->normals, 
+	   part->numNormals * sizeof(Point));
+    memcpy(mesh->coords + c->offset.coord, part->coords, 
+	   part->numCoords * sizeof(Position));
+
+    Face *faces = mesh->faces + c->faceOffset;
+    for (int i = 0; i < part->numFaces; i++) {
+	faces[i] = part->faces[i];
+	for (int k = 0; k < 3; k++) {
+	    Corner *v = &faces[i].corners[k];
+	    if (!fixIndex(&v->point, c->offset.point) ||
+		(v->coord != MISSING && 
+		 !fixIndex(&v->coord, c->offset.coord)) ||
+		(v->normal != MISSING && 
+		 !fixIndex(&v->normal, c->offset.normal)))
+		c->outOfRange = 1;
 	}
     }
-    qsort(solid->segments, solid->numSegments, sizeof(Segment), 
-	  compareSegmentBuild);
-    formatSegmentBuild(solid);
+    freeMeshBuild(part);
+}
+
+static void *runWork(void *data)
+{
+    Work *work = data;
+    int k;
+    while ((k = __sync_fetch_and_add(&work->next, 1)) < work->nbChunks)
+	work->run(&work->chunks[k], work->mesh);
+    return NULL;
+}
+
+// the chunks are shared between as many threads as there are cores
+static void runChunks(Chunk *chunks, int nbChunks, Mesh *mesh, 
+		      void (*run)(Chunk *, Mesh *))
+{
+    pthread_t threads[MAXTHREADS];
+    Work work = { chunks, nbChunks, 0, mesh, run };
+    int nbThreads = 0;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores > nbChunks)
+	cores = nbChunks;
+    if (cores > MAXTHREADS)
+	cores = MAXTHREADS;
+
+    while (nbThreads < cores - 1 && 
+	   !pthread_create(&threads[nbThreads], NULL, runWork, &work))
+	nbThreads++;
+    runWork(&work);
+    for (int i = 0; i < nbThreads; i++)
+	pthread_join(threads[i], NULL);
+}
+
+// chunks end on line boundaries
+static int splitFile(const char *data, size_t size, Chunk *chunks)
+{
+    size_t nbChunks = size / CHUNKSIZE + 1;
+    if (nbChunks > MAXCHUNKS)
+	nbChunks = MAXCHUNKS;
+
+    const char *end = data + size;
+    const char *p = data;
+    int n = 0;
+    for (size_t k = 1; k <= nbChunks && p < end; k++) {
+	Chunk *c = &chunks[n++];
+	memset(c, 0, sizeof(Chunk));
+	c->begin = p;
+	c->end = k == nbChunks ? end : data + size * k / nbChunks;
+	if (c->end < p)
+	    c->end = p;
+	c->end = skipLine(c->end, end);
+	p = c->end;
+    }
+    return n;
+}
+
+static int checkChunks(const Chunk *chunks, int nbChunks)
+{
+    int line = 1;
+    for (int k = 0; k < nbChunks; k++) {
+	if (chunks[k].error) {
+	    fprintf(stderr, "%s, line %d\n", chunks[k].error, 
+		    line + chunks[k].lines);
+	    return 0;
+	}
+	line += chunks[k].lines;
+    }
+    return 1;
+}
+
+// prefix sums of the chunk sizes give where each one is copied
+static void allocateObject(Mesh *mesh, Chunk *chunks, int nbChunks)
+{
+    for (int k = 0; k < nbChunks; k++) {
+	Chunk *c = &chunks[k];
+	c->offset.point = mesh->numVertices;
+	c->offset.normal = mesh->numNormals;
+	c->offset.coord = mesh->numCoords;
+	c->faceOffset = mesh->numFaces;
+	mesh->numVertices += c->part.numVertices;
+	mesh->numNormals += c->part.numNormals;
+	mesh->numCoords += c->part.numCoords;
+	mesh->numFaces += c->part.numFaces;
+    }
+    mesh->vertices = malloc(mesh->numVertices * sizeof(Point));
+    mesh->normals = malloc(mesh->numNormals * sizeof(Point));
+    mesh->coords = malloc(mesh->numCoords * sizeof(Position));
+    mesh->faces = malloc(mesh->numFaces * sizeof(Face));
+}
+
+Solid *loadObject(const char *fileName, const char *bmpName)
+{
+    size_t size;
+    const char *data = mapFile(fileName, &size);
+    if (data == NULL) {
+	perror(fileName);
+	return NULL;
+    }
+
+    Chunk chunks[MAXCHUNKS];
+    int nbChunks = splitFile(data, size, chunks);
+    runChunks(chunks, nbChunks, NULL, parseChunk);
+    unmapFile(data, size);
+
+    if (!checkChunks(chunks, nbChunks)) {
+	for (int k = 0; k < nbChunks; k++)
+	    freeMeshBuild(&chunks[k].part);
+	return NULL;
+    }
+    Mesh mesh = {0};
+    allocateObject(&mesh, chunks, nbChunks);
+    runChunks(chunks, nbChunks, &mesh, scatterChunk);
+
+    int normalSize = mesh.numNormals;
+    int outOfRange = 0;
+    for (int k = 0; k < nbChunks; k++)
+	outOfRange |= chunks[k].outOfRange;
+    if (outOfRange || !finishObject(&mesh, &normalSize)) {
+	fprintf(stderr, "Error during faces enumeration: "
+		"index out of range\n");
+	freeMeshBuild(&mesh);
+	return NULL;
+    }
+
+    Solid *solid = calloc(1, sizeof(Solid));
+    weldBuild(solid, &mesh);
+    if ((solid->texture = loadTexture(bmpName)))
+	printf("Texture successfully loaded\n");
+    else
+	printf("Error loading texture\n");
     printf("Object successfully loaded\n");
-    fclose(file);
     return solid;
 }
@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "coord.h"
+#include "occlusion.h"
+
+#define TILEWIDTH 8
+#define TILEHEIGHT 8
+#define FULL UINT64_MAX
+
+// each tile of 8x8 pixels keeps a depth behind which all its pixels are
+// hidden, and a working layer: the pixels covered since, with their
+// farthest depth, which replaces that depth once they fill the tile
+struct Occlusion {
+    int width;
+    int height;
+    int tilesW;
+    int tilesH;
+    float *zMax0;
+    float *zMax1;
+    uint64_t *masks;
+};
+
+static inline int min(int a, int b)
+{
+    return (a < b) ? a : b;
+}
+
+static inline int max(int a, int b)
+{
+    return (a > b) ? a : b;
+}
+
+Occlusion *initOcclusion(void)
+{
+    return calloc(1, sizeof(Occlusion));
+}
+
+void resetOcclusion(Occlusion *o, int width, int height)
+{
+    int tilesW = (width + TILEWIDTH - 1) / TILEWIDTH;
+    int tilesH = (height + TILEHEIGHT - 1) / TILEHEIGHT;
+    if (tilesW * tilesH != o->tilesW * o->tilesH) {
+	o->zMax0 = realloc(o->zMax0, (tilesW * tilesH + 1) * sizeof(float));
+	o->zMax1 = realloc(o->zMax1, (tilesW * tilesH + 1) * sizeof(float));
+	o->masks = realloc(o->masks, 
+			   (tilesW * tilesH + 1) * sizeof(uint64_t));
+    }
+    o->width = width;
+    o->height = height;
+    o->tilesW = tilesW;
+    o->tilesH = tilesH;
+    for (int t = 0; t < tilesW * tilesH; t++) {
+	o->zMax0[t] = INFINITY;
+	o->zMax1[t] = 0.;
+	o->masks[t] = 0;
+    }
+}
+
+// a triangle much nearer than the working layer starts it again
+static void mergeTile(Occlusion *o, int t, uint64_t mask, float depth)
+{
+    if (depth >= o->zMax0[t])
+	return;
+    if (o->masks[t] && 
+	o->zMax1[t] - depth > o->zMax0[t] - o->zMax1[t]) {
+	o->masks[t] = 0;
+	o->zMax1[t] = 0.;
+    }
+    o->masks[t] |= mask;
+    o->zMax1[t] = fmaxf(o->zMax1[t], depth);
+    if (o->masks[t] == FULL) {
+	o->zMax0[t] = o->zMax1[t];
+	o->masks[t] = 0;
+	o->zMax1[t] = 0.;
+    }
+}
+
+// an edge function of drawTriangle, positive inside the triangle
+typedef struct Edge {
+    int64_t value;
+    int64_t stepW;
+    int64_t stepH;
+} Edge;
+
+static void setEdge(Edge *e, const Coord *A, const Coord *B, int w, int h)
+{
+    Coord AB;
+    diffCoord(B, A, &AB);
+    e->stepW = AB.h;
+    e->stepH = -AB.w;
+    e->value = (int64_t) AB.h * (w - A->w) - (int64_t) AB.w * (h - A->h);
+}
+
+static inline int64_t getEdge(const Edge *e, int w, int h)
+{
+    return e->value + e->stepW * w + e->stepH * h;
+}
+
+// the pixels are those drawTriangle fills: the front faces only, each
+// pixel on the inner side of the three edges; 1 / depth is affine on
+// the screen, so the farthest depth of a tile is at one of its corners
+void occludeTriangle(Occlusion *o, const Coord *A, float depthA,
+		     const Coord *B, float depthB,
+		     const Coord *C, float depthC)
+{
+    Coord AB, BC;
+    diffCoord(B, A, &AB);
+    diffCoord(C, B, &BC);
+    if (productCoord(&AB, &BC) <= 0)
+	return;
+
+    int minW = max(0, min(min(A->w, B->w), C->w));
+    int maxW = min(o->width - 1, max(max(A->w, B->w), C->w));
+    int minH = max(0, min(min(A->h, B->h), C->h));
+    int maxH = min(o->height - 1, max(max(A->h, B->h), C->h));
+    if (minW > maxW || minH > maxH)
+	return;
+
+    Edge alpha, beta, gamma;
+    setEdge(&alpha, B, C, 0, 0);
+    setEdge(&beta, C, A, 0, 0);
+    setEdge(&gamma, A, B, 0, 0);
+    float det = getEdge(&alpha, A->w, A->h);
+    float farthest = fmaxf(depthA, fmaxf(depthB, depthC));
+
+    for (int th = minH / TILEHEIGHT; th <= maxH / TILEHEIGHT; th++) {
+	for (int tw = minW / TILEWIDTH; tw <= maxW / TILEWIDTH; tw++) {
+	    int w0 = tw * TILEWIDTH;
+	    int h0 = th * TILEHEIGHT;
+	    int w1 = min(w0 + TILEWIDTH, o->width) - 1;
+	    int h1 = min(h0 + TILEHEIGHT, o->height) - 1;
+	    // the pixels off the screen count as covered
+	    uint64_t inside = 0, off = 0;
+	    for (int h = 0; h < TILEHEIGHT; h++) {
+		for (int w = 0; w < TILEWIDTH; w++) {
+		    int bit = h * TILEWIDTH + w;
+		    inside |= (uint64_t) 
+			(getEdge(&alpha, w0 + w, h0 + h) >= 0 &&
+			 getEdge(&beta, w0 + w, h0 + h) >= 0 &&
+			 getEdge(&gamma, w0 + w, h0 + h) >= 0) << bit;
+		    off |= (uint64_t) (w0 + w > w1 || h0 + h > h1) << bit;
+		}
+	    }
+	    if (inside == 0)
+		continue;
+
+	    float nearest = INFINITY;
+	    for (int c = 0; c < 4; c++) {
+		int w = c & 1 ? w1 : w0;
+		int h = c & 2 ? h1 : h0;
+		float inverse = (getEdge(&alpha, w, h) / depthA + 
+				 getEdge(&beta, w, h) / depthB + 
+				 getEdge(&gamma, w, h) / depthC) / det;
+		nearest = fminf(nearest, inverse);
+	    }
+	    float depth = nearest > 0. ? fminf(farthest, 1. / nearest) : 
+		farthest;
+	    mergeTile(o, tw + th * o->tilesW, inside | off, depth);
+	}
+    }
+}
+
+// whether every pixel of the rectangle is hidden in front of depth
+int isOccludedRect(const Occlusion *o, const Coord *low, const Coord *high,
+		   float depth)
+{
+    int minW = max(0, low->w);
+    int maxW = min(o->width - 1, high->w);
+    int minH = max(0, low->h);
+    int maxH = min(o->height - 1, high->h);
+    if (minW > maxW || minH > maxH)
+	return 0;
+
+    int hidden = 1;
+    for (int th = minH / TILEHEIGHT; th <= maxH / TILEHEIGHT; th++) {
+	const float *row = &o->zMax0[th * o->tilesW];
+	for (int tw = minW / TILEWIDTH; tw <= maxW / TILEWIDTH; tw++)
+	    hidden &= row[tw] < depth;
+    }
+    return hidden;
+}
+
+void freeOcclusion(Occlusion *o)
+{
+    if (o == NULL)
+	return;
+    free(o->zMax0);
+    free(o->zMax1);
+    free(o->masks);
+    free(o);
+}
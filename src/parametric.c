@@ -3,14 +3,27 @@
 #include <math.h>
 #include <string.h>
 
-#include "stack.h"
-#include "state.h"
 #include "parametric.h"
+#include "native.h"
 
 #define MAXLENGTH 256
-#define NB_FUNCTIONS 4
-#define NB_KEYWORDS 9
-
+#define MAXSTACK 64
+// the points evaluated by each instruction of the batch evaluator
+#define LANES 16
+// 1.5 * 2^23, adding and subtracting it rounds a float to an integer
+#define ROUNDING 12582912.f
+// below it, x reduced by its multiple of pi / 2 keeps float accuracy
+#define SINLIMIT 4096.f
+
+typedef float Lanes __attribute__ ((vector_size (LANES * sizeof(float))));
+typedef int Mask __attribute__ ((vector_size (LANES * sizeof(int))));
+
+// lanes are passed by address: vectors this wide have no common
+// calling convention without AVX-512
+#define SELECT(m, a, b) ((Lanes) (((Mask) (a) & (m)) | ((Mask) (b) & ~(m))))
+
+// the element of the stack of the compiler, the value of a function or an
+// operator being its opcode
 typedef struct ElementEquation {
     int valueType;
     union {
@@ -20,32 +33,68 @@ typedef struct ElementEquation {
     } value;
 } ElementEquation;
 
+// pushes a constant or an input, or replaces the values on top of the
+// stack by the result of an operator or a function
+typedef struct Instruction {
+    int opcode;
+    union {
+	float number;
+	int variable;
+    };
+} Instruction;
+
+// an output compiled once into postfix order
+typedef struct Program {
+    int length;
+    Instruction *code;
+} Program;
+
+// the outputs are merged into a graph, where each node is computed once
+// from the nodes before it; on a grid, the nodes depending on one input
+// only are read from a table of their values along its axis
+typedef struct Node {
+    int opcode;
+    union {
+	float number;
+	int variable;
+    };
+    int left;
+    int right;
+    int axis;
+    int table;
+} Node;
+
 static struct{
-    State *state;
-    Stack *stack;
     int input;
     int output;
-    char **equation;
+    int length;
+    Node *nodes;
+    int *roots;
+    int nbTables;
+    float **tables;
+    void *native;
+    void (*getValues)(float **, float **, int);
+    void (*getGridValues)(float **, int **, float **, int);
 } Equation;
 
 enum {
     FUNCTION, OPERATOR, NUMBER
 };
 
+// the axis of a node which depends on no input or on several of them
 enum {
-    COS, SIN, SQRT, SQR
-};
-
-enum {
-    PLUS, MINUS, TIMES, OVER
+    NOAXIS = -1, SEVERAL = -2
 };
 
 enum {
-    POTENTIAL, ACCEPT, REFUSE
+    CONSTANT, VARIABLE, PLUS, MINUS, TIMES, OVER, COS, SIN, SQRT, SQR
 };
 
-enum {
-    MINS, MAXS, PRECISIONS, MINT, MAXT, PRECISIONT, X, Y, Z
+static const struct {
+    const char *name;
+    int opcode;
+} functions[] = {
+    {"cos", COS}, {"sin", SIN}, {"sqrt", SQRT}, {"sqr", SQR}
 };
 
 static inline int isNumber(char c)
@@ -104,48 +153,17 @@ static inline int isLetter(char c)
     return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'));
 }
 
-static float analyseVariable(char *s, int *i, float *input)
-{
-    *i = *i + 1;
-    int variable = analyseInt(s, i);
-
-    if (variable < 0 || variable >= Equation.input) {
-	fprintf(stderr, "Error analyzing variable: index not in range\n");
-	return 0;
-    }
-    return input[variable];
-}
-
-static void handleFunction(int id, char xyz, char f, int fFinalCharId, int j)
-{
-    if ((getState(Equation.state, id) == POTENTIAL && 
-	 j < fFinalCharId && xyz != f) ||
-	(getState(Equation.state, id) == ACCEPT && j > fFinalCharId))
-	setState(Equation.state, REFUSE, id);
-    if (getState(Equation.state, id) == POTENTIAL && 
-	j == fFinalCharId && xyz == f)
-	setState(Equation.state, ACCEPT, id);
-}
-
-
 static int analyseFunction(char *xyz, int *i)
 {
-    int j = 0;
-    char *cos = "cos";
-    char *sin = "sin";
-    char *sqrt = "sqrt";
-    char *sqr = "sqr";
-    resetState(Equation.state, POTENTIAL);
-   
-    while(isLetter(xyz[*i])) {
-	handleFunction(COS, xyz[*i], cos[j], 2, j);
-	handleFunction(SIN, xyz[*i], sin[j], 2, j);
-	handleFunction(SQRT, xyz[*i], sqrt[j], 3, j);
-	handleFunction(SQR, xyz[*i], sqr[j], 2, j);
-	j++;
-	(*i)++;
-    }
-    return analyseState(Equation.state, ACCEPT);
+    int length;
+    for (length = 0; isLetter(xyz[*i + length]); length++);
+    char *name = &xyz[*i];
+    *i += length - 1;
+    for (int f = 0; f < sizeof(functions) / sizeof(functions[0]); f++)
+	if (strlen(functions[f].name) == length &&
+	    strncmp(functions[f].name, name, length) == 0)
+	    return functions[f].opcode;
+    return -1;
 }
 
 static int isBinaryOperator(char c)
@@ -175,157 +193,599 @@ static int analyseBinaryOperator(char *xyz, int *i)
     return -1;
 }
 
-static float computeOperator(float x, int operator, float y)
+static int errorEquation(const char *s, const char *message)
+{
+    fprintf(stderr, "Error parsing equation %s: %s\n", s, message);
+    return 0;
+}
+
+static void emit(Program *p, int opcode, float number, int variable)
+{
+    Instruction *c = &p->code[p->length++];
+    c->opcode = opcode;
+    if (opcode == VARIABLE)
+	c->variable = variable;
+    else
+	c->number = number;
+}
+
+// each ')' applies the operator or the function on top of the stack, the
+// values of which were emitted before it
+static int compileOutput(char *s, Program *p)
+{
+    ElementEquation stack[MAXSTACK];
+    int top = 0;
+    p->length = 0;
+    p->code = malloc((strlen(s) + 1) * sizeof(Instruction));
+
+    for (int i = 0; s[i]; i++) {
+	ElementEquation elmtA;
+	ElementEquation elmtB;
+	ElementEquation elmtC;
+
+	if (top == MAXSTACK)
+	    return errorEquation(s, "too many nested expressions");
+	if (isNumber(s[i])) {
+	    elmtA.value.number = analyseFloat(s, &i);
+	    elmtA.valueType = NUMBER;
+	    emit(p, CONSTANT, elmtA.value.number, 0);
+	    stack[top++] = elmtA;
+	} else if (isLetter(s[i])) {
+	    if ((elmtA.value.function = analyseFunction(s, &i)) == -1)
+		return errorEquation(s, "unknown symbol");
+	    elmtA.valueType = FUNCTION;
+	    stack[top++] = elmtA;
+	} else if (s[i] == '$') {
+	    i++;
+	    int variable = isNumber(s[i]) ? analyseInt(s, &i) : -1;
+	    if (variable < 0 || variable >= Equation.input)
+		return errorEquation(s, "variable index not in range");
+	    elmtA.valueType = NUMBER;
+	    emit(p, VARIABLE, 0., variable);
+	    stack[top++] = elmtA;
+	} else if (isBinaryOperator(s[i])) {
+	    elmtA.value.operator = analyseBinaryOperator(s, &i);
+	    elmtA.valueType = OPERATOR;
+	    stack[top++] = elmtA;
+	} else if (s[i] == ')') {
+	    if (top == 0)
+		return errorEquation(s, "expected expression before ')'");
+	    elmtA = stack[--top];
+	    if (elmtA.valueType != NUMBER)
+		return errorEquation(s, "structural problem");
+	    if (top == 0)
+		return errorEquation(s, "expected expression before number");
+	    elmtB = stack[--top];
+	    if (elmtB.valueType == OPERATOR) {
+		if (top == 0)
+		    return errorEquation(s, 
+					 "expected expression before operator");
+		elmtC = stack[--top];
+		if (elmtC.valueType != NUMBER)
+		    return errorEquation(s, "first argument of operator is "
+					 "not a number");
+		emit(p, elmtB.value.operator, 0., 0);
+	    } else if (elmtB.valueType == FUNCTION) {
+		emit(p, elmtB.value.function, 0., 0);
+	    } else {
+		return errorEquation(s, "double number");
+	    }
+	    stack[top++] = elmtA;
+	}
+    }
+
+    if (top == 0)
+	return errorEquation(s, "no result");
+    if (stack[top - 1].valueType != NUMBER)
+	return errorEquation(s, "not a number");
+    if (top > 1)
+	return errorEquation(s, "expected ')'");
+    return 1;
+}
+
+static inline int isBinary(int opcode)
 {
-    switch (operator) {
+    return opcode >= PLUS && opcode <= OVER;
+}
+
+static inline int isUnary(int opcode)
+{
+    return opcode >= COS && opcode <= SQR;
+}
+
+static float applyNode(const Node *n, float a, float b)
+{
+    switch (n->opcode) {
+    case CONSTANT:
+	return n->number;
     case PLUS:
-	return x + y;
+	return a + b;
+    case MINUS:
+	return a - b;
+    case TIMES:
+	return a * b;
+    case OVER:
+	return b != 0. ? a / b : 0.;
+    case COS:
+	return cos(a);
+    case SIN:
+	return sin(a);
+    case SQRT:
+	return sqrt(a);
+    case SQR:
+	return a * a;
+    }
+    return 0.;
+}
+
+static unsigned hashNode(const Node *n)
+{
+    unsigned hash = 2166136261u;
+    int key[4] = {n->opcode, n->variable, n->left, n->right};
+    for (int i = 0; i < 4; i++)
+	hash = (hash ^ key[i]) * 16777619u;
+    return hash;
+}
+
+static int isSameNode(const Node *n, const Node *m)
+{
+    return n->opcode == m->opcode && n->variable == m->variable && 
+	n->left == m->left && n->right == m->right;
+}
+
+// a node of constants is folded into a constant, then the node is looked
+// up among the ones already built, so that it is shared by the outputs
+static int addNode(Node n, int *table, unsigned mask)
+{
+    const Node *nodes = Equation.nodes;
+    int folded = isUnary(n.opcode) || isBinary(n.opcode);
+    float a = 0., b = 0.;
+
+    if ((n.opcode == PLUS || n.opcode == TIMES) && n.left > n.right) {
+	int swap = n.left;
+	n.left = n.right;
+	n.right = swap;
+    }
+    if (n.left >= 0) {
+	folded = folded && nodes[n.left].opcode == CONSTANT;
+	a = nodes[n.left].number;
+    }
+    if (n.right >= 0) {
+	folded = folded && nodes[n.right].opcode == CONSTANT;
+	b = nodes[n.right].number;
+    }
+    if (folded) {
+	n.number = applyNode(&n, a, b);
+	n.opcode = CONSTANT;
+	n.left = n.right = -1;
+    }
+
+    unsigned h = hashNode(&n) & mask;
+    for (; table[h] != -1; h = (h + 1) & mask) {
+	if (isSameNode(&Equation.nodes[table[h]], &n))
+	    return table[h];
+    }
+    Equation.nodes[Equation.length] = n;
+    return table[h] = Equation.length++;
+}
+
+// the nodes left behind by the folding of constants are removed, the
+// others keeping their order
+static void sweepGraph(void)
+{
+    int *index = malloc(Equation.length * sizeof(int));
+    memset(index, 0, Equation.length * sizeof(int));
+    for (int i = 0; i < Equation.output; i++)
+	index[Equation.roots[i]] = 1;
+    for (int k = Equation.length - 1; k >= 0; k--) {
+	const Node *n = &Equation.nodes[k];
+	if (index[k] && n->left >= 0)
+	    index[n->left] = 1;
+	if (index[k] && n->right >= 0)
+	    index[n->right] = 1;
+    }
+
+    int length = 0;
+    for (int k = 0; k < Equation.length; k++) {
+	if (!index[k])
+	    continue;
+	Node *n = &Equation.nodes[length];
+	*n = Equation.nodes[k];
+	if (n->left >= 0)
+	    n->left = index[n->left];
+	if (n->right >= 0)
+	    n->right = index[n->right];
+	index[k] = length++;
+    }
+    for (int i = 0; i < Equation.output; i++)
+	Equation.roots[i] = index[Equation.roots[i]];
+    Equation.length = length;
+    free(index);
+}
+
+static int mergeAxis(int a, int b)
+{
+    if (a == NOAXIS || a == b)
+	return b;
+    return b == NOAXIS ? a : SEVERAL;
+}
+
+// a table is kept for the nodes of one input which are needed by a node
+// of several inputs, or by an output
+static void setTableNode(Node *n)
+{
+    if (n->axis >= 0 && n->table == -1)
+	n->table = Equation.nbTables++;
+}
+
+static void setAxisGraph(void)
+{
+    Node *nodes = Equation.nodes;
+    Equation.nbTables = 0;
+
+    for (int k = 0; k < Equation.length; k++) {
+	Node *n = &nodes[k];
+	n->table = -1;
+	n->axis = n->opcode == VARIABLE ? n->variable : NOAXIS;
+	if (n->left >= 0)
+	    n->axis = mergeAxis(n->axis, nodes[n->left].axis);
+	if (n->right >= 0)
+	    n->axis = mergeAxis(n->axis, nodes[n->right].axis);
+	if (n->left >= 0 && nodes[n->left].axis != n->axis)
+	    setTableNode(&nodes[n->left]);
+	if (n->right >= 0 && nodes[n->right].axis != n->axis)
+	    setTableNode(&nodes[n->right]);
+    }
+    for (int i = 0; i < Equation.output; i++)
+	setTableNode(&nodes[Equation.roots[i]]);
+}
+
+// the postfix code of the outputs is run on nodes instead of values
+static void buildGraph(const Program *programs)
+{
+    unsigned size = 0;
+    for (int i = 0; i < Equation.output; i++)
+	size += programs[i].length;
+    unsigned mask = 1;
+    while (mask < 2 * size)
+	mask *= 2;
+    int *table = malloc(mask * sizeof(int));
+    memset(table, 0xff, mask * sizeof(int));
+    mask--;
+
+    Equation.length = 0;
+    Equation.nodes = malloc(size * sizeof(Node));
+    Equation.roots = malloc(Equation.output * sizeof(int));
+    for (int i = 0; i < Equation.output; i++) {
+	int stack[MAXSTACK], top = -1;
+	for (int k = 0; k < programs[i].length; k++) {
+	    const Instruction *c = &programs[i].code[k];
+	    Node n = {.opcode = c->opcode, .left = -1, .right = -1};
+	    if (c->opcode == VARIABLE)
+		n.variable = c->variable;
+	    else
+		n.number = c->number;
+	    if (isBinary(c->opcode))
+		n.right = stack[top--];
+	    if (isBinary(c->opcode) || isUnary(c->opcode))
+		n.left = stack[top--];
+	    stack[++top] = addNode(n, table, mask);
+	}
+	Equation.roots[i] = stack[top];
+    }
+    free(table);
+    sweepGraph();
+    setAxisGraph();
+}
+
+// the value of every node, those of the outputs among them
+static void runGraph(const float *input, float *value)
+{
+    for (int k = 0; k < Equation.length; k++) {
+	const Node *n = &Equation.nodes[k];
+	if (n->opcode == VARIABLE)
+	    value[k] = input[n->variable];
+	else
+	    value[k] = applyNode(n, n->left >= 0 ? value[n->left] : 0., 
+				 n->right >= 0 ? value[n->right] : 0.);
+    }
+}
+
+// sin(x + quarter * pi / 2): x is brought back to [-pi / 4, pi / 4] by
+// a multiple of pi / 2 split in three parts, whose quadrant picks the
+// polynomial of the sine or of the cosine and the sign; the lanes beyond
+// SINLIMIT or not finite are left to libm
+static void sinLanes(Lanes *v, int quarter)
+{
+    Lanes zero = {0};
+    Mask small = (Lanes) ((Mask) *v & 0x7fffffff) <= SINLIMIT;
+    Lanes x = SELECT(small, *v, zero);
+    Lanes t = x * (float) M_2_PI + ROUNDING - ROUNDING;
+    Mask q = __builtin_convertvector(t, Mask) + quarter;
+    Lanes r = ((x - t * 1.5703125f) - t * 4.837512969970703125e-4f) - 
+	t * 7.54978995489188216e-8f;
+    Lanes r2 = r * r;
+    Lanes sine = r + r * r2 * (-1.6666654611e-1f + r2 * 
+			       (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+    Lanes cosine = 1.f - 0.5f * r2 + r2 * r2 * 
+	(4.166664568298827e-2f + r2 * 
+	 (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+    Lanes y = SELECT(-(q & 1), cosine, sine);
+    y = (Lanes) ((Mask) y ^ (q & 2) << 30);
+    int all = -1;
+    for (int l = 0; l < LANES; l++)
+	all &= small[l];
+    for (int l = 0; !all && l < LANES; l++)
+	if (!small[l])
+	    y[l] = quarter ? cos((*v)[l]) : sin((*v)[l]);
+    *v = y;
+}
+
+// an estimate of the inverse square root from the bits of x, refined by
+// Newton's method, then a last step of Heron's on the square root; the
+// lanes which are not normal positive floats are left to libm
+static void sqrtLanes(Lanes *v)
+{
+    Lanes x = *v;
+    Mask normal = (x >= 1.17549435e-38f) & (x < INFINITY);
+    Lanes y = (Lanes) (0x5f3759df - ((Mask) x >> 1));
+    y = y * (1.5f - 0.5f * x * y * y);
+    y = y * (1.5f - 0.5f * x * y * y);
+    Lanes r = x * y;
+    r = 0.5f * (r + x / r);
+    int all = -1;
+    for (int l = 0; l < LANES; l++)
+	all &= normal[l];
+    for (int l = 0; !all && l < LANES; l++)
+	if (!normal[l])
+	    r[l] = sqrt(x[l]);
+    *v = r;
+}
+
+// the value of the node k on LANES points at once
+static void applyNodeLanes(int k, const Lanes *input, Lanes *value)
+{
+    const Node *n = &Equation.nodes[k];
+    int a = n->left, b = n->right;
+    Lanes zero = {0};
+
+    switch (n->opcode) {
+    case CONSTANT:
+	value[k] = zero + n->number;
+	break;
+    case VARIABLE:
+	value[k] = input[n->variable];
+	break;
+    case PLUS:
+	value[k] = value[a] + value[b];
 	break;
     case MINUS:
-	return x - y;
+	value[k] = value[a] - value[b];
 	break;
     case TIMES:
-	return x * y;
+	value[k] = value[a] * value[b];
 	break;
     case OVER:
-	if (y == 0.) {
-	    fprintf(stderr, "Error parsing equation: division by zero\n");
-	    return 0.;
-	}
-	return x / y;
+	value[k] = SELECT(value[b] != 0.f, value[a] / value[b], zero);
 	break;
-    default:
-	fprintf(stderr, "Error parsing equation: unknown operator\n");
-	return 0.;
+    case COS:
+	value[k] = value[a];
+	sinLanes(&value[k], 1);
+	break;
+    case SIN:
+	value[k] = value[a];
+	sinLanes(&value[k], 0);
+	break;
+    case SQRT:
+	value[k] = value[a];
+	sqrtLanes(&value[k]);
+	break;
+    case SQR:
+	value[k] = value[a] * value[a];
 	break;
     }
-    return 0.;
 }
 
-static float computeFunction(int function, float x)
+// same as runGraph on LANES points at once
+static void runGraphLanes(const Lanes *input, Lanes *value)
 {
-    switch (function) {
-    case COS:
-	return cos(x);
+    for (int k = 0; k < Equation.length; k++)
+	applyNodeLanes(k, input, value);
+}
+
+// the nodes of one input are read from their tables, those of several
+// ones computed from them
+static void runGridLanes(int **grids, int first, int count, Lanes *value)
+{
+    Lanes zero = {0};
+
+    for (int k = 0; k < Equation.length; k++) {
+	const Node *n = &Equation.nodes[k];
+	if (n->table >= 0) {
+	    const float *table = Equation.tables[n->table];
+	    const int *grid = &grids[n->axis][first];
+	    value[k] = zero;
+	    for (int l = 0; l < count; l++)
+		value[k][l] = table[grid[l]];
+	} else if (n->axis < 0) {
+	    applyNodeLanes(k, NULL, value);
+	}
+    }
+}
+
+// the batch evaluator as seen by the generated code, which gets the
+// lanes of the machine it is compiled on
+static const char nativeLanes[] =
+    "#include <string.h>\n"
+    "#include <math.h>\n"
+    "typedef float Lanes __attribute__ ((vector_size (64)));\n"
+    "typedef int Mask __attribute__ ((vector_size (64)));\n"
+    "#define SELECT(m, a, b) "
+    "((Lanes) (((Mask) (a) & (m)) | ((Mask) (b) & ~(m))))\n"
+    "static inline Lanes sinLanes(Lanes v, int quarter)\n"
+    "{\n"
+    "    Lanes zero = {0};\n"
+    "    Mask small = (Lanes) ((Mask) v & 0x7fffffff) <= 4096.f;\n"
+    "    Lanes x = SELECT(small, v, zero);\n"
+    "    Lanes t = x * 0.636619772f + 12582912.f - 12582912.f;\n"
+    "    Mask q = __builtin_convertvector(t, Mask) + quarter;\n"
+    "    Lanes r = ((x - t * 1.5703125f) - "
+    "t * 4.837512969970703125e-4f) - t * 7.54978995489188216e-8f;\n"
+    "    Lanes r2 = r * r;\n"
+    "    Lanes sine = r + r * r2 * (-1.6666654611e-1f + r2 * "
+    "(8.3321608736e-3f + r2 * -1.9515295891e-4f));\n"
+    "    Lanes cosine = 1.f - 0.5f * r2 + r2 * r2 * "
+    "(4.166664568298827e-2f + r2 * "
+    "(-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));\n"
+    "    Lanes y = SELECT(-(q & 1), cosine, sine);\n"
+    "    y = (Lanes) ((Mask) y ^ (q & 2) << 30);\n"
+    "    int all = -1;\n"
+    "    for (int l = 0; l < 16; l++)\n"
+    "\tall &= small[l];\n"
+    "    for (int l = 0; !all && l < 16; l++)\n"
+    "\tif (!small[l])\n"
+    "\t    y[l] = quarter ? cos(v[l]) : sin(v[l]);\n"
+    "    return y;\n"
+    "}\n"
+    "static inline Lanes sqrtLanes(Lanes x)\n"
+    "{\n"
+    "    Mask normal = (x >= 1.17549435e-38f) & (x < INFINITY);\n"
+    "    Lanes y = (Lanes) (0x5f3759df - ((Mask) x >> 1));\n"
+    "    y = y * (1.5f - 0.5f * x * y * y);\n"
+    "    y = y * (1.5f - 0.5f * x * y * y);\n"
+    "    Lanes r = x * y;\n"
+    "    r = 0.5f * (r + x / r);\n"
+    "    int all = -1;\n"
+    "    for (int l = 0; l < 16; l++)\n"
+    "\tall &= normal[l];\n"
+    "    for (int l = 0; !all && l < 16; l++)\n"
+    "\tif (!normal[l])\n"
+    "\t    r[l] = sqrt(x[l]);\n"
+    "    return r;\n"
+    "}\n"
+    "static inline Lanes overLanes(Lanes a, Lanes b)\n"
+    "{\n"
+    "    Lanes zero = {0};\n"
+    "    return SELECT(b != 0.f, a / b, zero);\n"
+    "}\n";
+
+// the value of the node k from the ones before it, named after their index
+static void writeNode(FILE *file, int k)
+{
+    static const char *operators[] = {
+	[PLUS] = "+", [MINUS] = "-", [TIMES] = "*"
+    };
+    const Node *n = &Equation.nodes[k];
+
+    fprintf(file, "\tLanes v%d = ", k);
+    switch (n->opcode) {
+    case CONSTANT:
+	fprintf(file, "zero + (float) %.9g", n->number);
+	break;
+    case VARIABLE:
+	fprintf(file, "input[%d]", n->variable);
 	break;
+    case PLUS:
+    case MINUS:
+    case TIMES:
+	fprintf(file, "v%d %s v%d", n->left, operators[n->opcode], 
+		n->right);
+	break;
+    case OVER:
+	fprintf(file, "overLanes(v%d, v%d)", n->left, n->right);
+	break;
+    case COS:
     case SIN:
-	return sin(x);
+	fprintf(file, "sinLanes(v%d, %d)", n->left, n->opcode == COS);
 	break;
     case SQRT:
-	if (x == 0.) {
-	    fprintf(stderr, "Error parsing equation: sqrt of negative\n");
-	    return 0.;
-	}
-	return sqrt(x);
+	fprintf(file, "sqrtLanes(v%d)", n->left);
 	break;
     case SQR:
-	return x * x;
-	break;
-    default:
-	fprintf(stderr, "Error parsing equation: unknown function\n");
-	return 0.;
+	fprintf(file, "v%d * v%d", n->left, n->left);
 	break;
     }
-    return 0.;
-}	
-	    
-static float getValue(float *input, int output)
+    fprintf(file, ";\n");
+}
+
+// on a grid, the nodes with a table are read from it, and the other nodes
+// of one input are left out
+static void writeGraph(FILE *file, int grid)
 {
-    ElementEquation result;
-    resetStack(Equation.stack);
-    char *s = Equation.equation[output];
+    for (int k = 0; k < Equation.length; k++) {
+	const Node *n = &Equation.nodes[k];
+	if (!grid || n->axis < 0)
+	    writeNode(file, k);
+	else if (n->table >= 0)
+	    fprintf(file, "\tLanes v%d = zero;\n"
+		    "\tfor (int l = 0; l < count; l++)\n"
+		    "\t    v%d[l] = tables[%d][grids[%d][first + l]];\n", 
+		    k, k, n->table, n->axis);
+    }
+    for (int i = 0; i < Equation.output; i++)
+	fprintf(file, "\tmemcpy(&outputs[%d][first], &v%d, "
+		"count * sizeof(float));\n", i, Equation.roots[i]);
+}
 
-    for (int i = 0; s[i]; i++) {
-	ElementEquation elmtA;
-	ElementEquation elmtB;
-	ElementEquation elmtC;
-	
-	if (isNumber(s[i])) {
-	    elmtA.value.number = analyseFloat(s, &i);
-	    elmtA.valueType = NUMBER;
-	    addDataStack(Equation.stack, &elmtA);
-	} else if (isLetter(s[i])) {
-	    if ((elmtA.value.function = analyseFunction(s, &i)) != -1) {
-		elmtA.valueType = FUNCTION;
-	    } else {
-		fprintf(stderr, "Error parsing equation: unknown symbol\n");
-		return 0;
-	    }
-	    addDataStack(Equation.stack, &elmtA);
-	} else if (s[i] == '$') {
-	    elmtA.value.number = analyseVariable(s, &i, input);
-	    elmtA.valueType = NUMBER;
-	    addDataStack(Equation.stack, &elmtA);
-	} else if (isBinaryOperator(s[i])) {
-	    elmtA.value.operator = analyseBinaryOperator(s, &i);
-	    elmtA.valueType = OPERATOR;
-	    addDataStack(Equation.stack, &elmtA);
-	} else if (s[i] == ')') {
-	    if (voidStack(Equation.stack)) {
-		fprintf(stderr, "Error parsing equation: expected expression before ')'\n");
-		return 0;
-	    }			
-		
-	    elmtA = *((ElementEquation *)readDataStack(Equation.stack));
-	    removeDataStack(Equation.stack);
-	    if (elmtA.valueType == NUMBER) {
-		if (voidStack(Equation.stack)) {
-		fprintf(stderr, "Error parsing equation: expected expression before number\n");
-		return 0;
-	    }
-		elmtB = *((ElementEquation *)readDataStack(Equation.stack));
-		removeDataStack(Equation.stack);
-	        if (elmtB.valueType == OPERATOR) {
-		    if (voidStack(Equation.stack)) {
-			fprintf(stderr, "Error parsing equation: expecting expression before operator\n");
-			return 0;
-		    }			
-			
-		    elmtC = *((ElementEquation *)readDataStack(Equation.stack));
-		    removeDataStack(Equation.stack);
-		    if (elmtC.valueType != NUMBER) {
-			fprintf(stderr, "Error parsing equation: first argument of operator is not a number\n");
-			return 0;
-		    }			
-		    result.value.number = computeOperator(elmtC.value.number, 
-							  elmtB.value.operator, 
-							  elmtA.value.number);
-		    result.valueType = NUMBER;
-		    addDataStack(Equation.stack, &result);
-		} else if (elmtB.valueType == FUNCTION) {
-		    result.value.number = computeFunction(elmtB.value.function, 
-							  elmtA.value.number);
-		    result.valueType = NUMBER;
-		    addDataStack(Equation.stack, &result);
-		} else {
-		    fprintf(stderr, "Error parsing equation: double number\n");
-		    return 0;
-		}
-	    } else {
-		fprintf(stderr, "Error parsing equation: structural problem\n");
-		return 0;
-	    }
-	}
+// the same loops as getValuesFromEquation and getGridValuesFromEquation,
+// with the graph unrolled
+static char *writeNative(void)
+{
+    char *source = NULL;
+    size_t size;
+    FILE *file = open_memstream(&source, &size);
+    if (file == NULL) {
+	perror("open_memstream");
+	return NULL;
     }
 
-    if (voidStack(Equation.stack)) {
-	fprintf(stderr, "Error parsing equation: no result\n");
-	return 0;
+    fprintf(file, "%s\nvoid getValues(float **inputs, float **outputs, "
+	    "int n)\n{\n    Lanes input[%d], zero = {0};\n"
+	    "    for (int first = 0; first < n; first += 16) {\n"
+	    "\tint count = n - first < 16 ? n - first : 16;\n"
+	    "\tfor (int i = 0; i < %d; i++) {\n"
+	    "\t    input[i] = zero;\n"
+	    "\t    memcpy(&input[i], &inputs[i][first], "
+	    "count * sizeof(float));\n\t}\n", 
+	    nativeLanes, Equation.input + 1, Equation.input);
+    writeGraph(file, 0);
+    fprintf(file, "    }\n}\n\nvoid getGridValues(float **tables, "
+	    "int **grids, float **outputs, int n)\n{\n"
+	    "    Lanes zero = {0};\n"
+	    "    for (int first = 0; first < n; first += 16) {\n"
+	    "\tint count = n - first < 16 ? n - first : 16;\n");
+    writeGraph(file, 1);
+    fprintf(file, "    }\n}\n");
+
+    if (fclose(file) != 0) {
+	free(source);
+	return NULL;
     }
+    return source;
+}
 
-    result = *((ElementEquation *)readDataStack(Equation.stack));
-    removeDataStack(Equation.stack);
+// the equation compiled to machine code, the batch evaluator staying in
+// use when that fails
+static void loadNative(void)
+{
+    char *source = writeNative();
 
-    if (result.valueType != NUMBER) {
-	fprintf(stderr, "Error parsing equation: not a number\n");
-	return 0;
+    if (source != NULL && (Equation.native = openNative(source)) != NULL) {
+	Equation.getValues = getNative(Equation.native, "getValues");
+	Equation.getGridValues = getNative(Equation.native, "getGridValues");
     }
-    return result.value.number;
+    if (Equation.getValues == NULL || Equation.getGridValues == NULL)
+	printf("Equation interpreted: native code unavailable\n");
+    free(source);
 }
 
+// the bounds and precision of the inputs are allocated for the caller,
+// and left NULL when the equation can't be loaded
 int initEquation(float **min, float **max, int **precision, 
 			int *nbInput, int *nbOutput, const char *eqName) 
 {
+    *min = *max = NULL;
+    *precision = NULL;
     FILE *file = fopen(eqName, "r");
     if (file == NULL) {
 	perror(eqName);
@@ -348,43 +808,146 @@ int initEquation(float **min, float **max, int **precision,
     *min = malloc(Equation.input * sizeof(float));
     *max = malloc(Equation.input * sizeof(float));
     *precision = malloc(Equation.input * sizeof(int));
-    Equation.equation = malloc(Equation.output * sizeof(char *));
+    Program *programs = calloc(Equation.output, sizeof(Program));
 
+    int ok = 1;
     while (fscanf(file, "%s", str) != EOF) {
 	if (strcmp(str, "input") == 0 && 
 	    fscanf(file, "%f %f %d", &((*min)[i]), &((*max)[i]), &((*precision)[i])))
 	    i++;
-	else if (strcmp(str, "output") == 0 && fscanf(file, "%s", str)) {
-	    Equation.equation[j] = malloc((strlen(str) + 1) * sizeof(char));
-	    strcpy(Equation.equation[j], str);
-	    j++;
-	}
+	else if (strcmp(str, "output") == 0 && fscanf(file, "%s", str))
+	    ok = compileOutput(str, &programs[j++]) && ok;
     }
 
-    Equation.state = initState(NB_FUNCTIONS);
-    Equation.stack = initStack(sizeof(ElementEquation));
     *nbInput = Equation.input;
     *nbOutput = Equation.output;
 
     fclose(file);
-    if (i != Equation.input || j != Equation.output) {
-	freeEquation();
+    ok = ok && i == Equation.input && j == Equation.output;
+    if (ok)
+	buildGraph(programs);
+    for (int k = 0; k < Equation.output; k++)
+	free(programs[k].code);
+    free(programs);
+    if (!ok) {
+	free(*min);
+	free(*max);
+	free(*precision);
+	*min = *max = NULL;
+	*precision = NULL;
 	return 0;
     }
+    loadNative();
     return 1;
 }
 
+// the number of nodes computed for each point
+int getSizeEquation(void)
+{
+    return Equation.length;
+}
+
+// one point at a time, the reference the batch and grid evaluators are
+// checked against in test_parametric
 void getValueFromEquation(float *input, float *output)
 {
+    float value[Equation.length];
+    runGraph(input, value);
     for (int i = 0; i < Equation.output; i++)
-	output[i] = getValue(input, i);
+	output[i] = value[Equation.roots[i]];
+}
+
+// the n points are given and taken one array per input and per output;
+// unlike the grid, every node is computed, so this is what exercises the
+// lanes and native code of all operators on arbitrary points
+void getValuesFromEquation(float **inputs, float **outputs, int n)
+{
+    if (Equation.getValues != NULL) {
+	Equation.getValues(inputs, outputs, n);
+	return;
+    }
+    Lanes input[Equation.input + 1], value[Equation.length];
+    for (int first = 0; first < n; first += LANES) {
+	int count = n - first < LANES ? n - first : LANES;
+	for (int i = 0; i < Equation.input; i++) {
+	    memset(&input[i], 0, sizeof(Lanes));
+	    memcpy(&input[i], &inputs[i][first], count * sizeof(float));
+	}
+	runGraphLanes(input, value);
+	for (int i = 0; i < Equation.output; i++)
+	    memcpy(&outputs[i][first], &value[Equation.roots[i]], 
+		   count * sizeof(float));
+    }
+}
+
+static void freeTables(void)
+{
+    for (int i = 0; Equation.tables != NULL && i < Equation.nbTables; i++)
+	free(Equation.tables[i]);
+    free(Equation.tables);
+    Equation.tables = NULL;
+}
+
+// input i takes lengths[i] values from min[i] by interval[i], the nodes
+// with a table being computed once for each value of their input
+void initGridEquation(const float *min, const float *interval, 
+		      const int *lengths)
+{
+    float input[Equation.input + 1], value[Equation.length];
+
+    freeTables();
+    Equation.tables = malloc(Equation.nbTables * sizeof(float *));
+    for (int k = 0; k < Equation.length; k++) {
+	const Node *n = &Equation.nodes[k];
+	if (n->table >= 0)
+	    Equation.tables[n->table] = malloc(lengths[n->axis] * 
+					       sizeof(float));
+    }
+
+    for (int i = 0; i < Equation.input; i++)
+	input[i] = min[i];
+    for (int i = 0; i < Equation.input; i++) {
+	for (int g = 0; g < lengths[i]; g++) {
+	    // the interval of an axis of one value is undefined
+	    input[i] = g ? min[i] + interval[i] * g : min[i];
+	    runGraph(input, value);
+	    for (int k = 0; k < Equation.length; k++) {
+		const Node *n = &Equation.nodes[k];
+		if (n->table >= 0 && n->axis == i)
+		    Equation.tables[n->table][g] = value[k];
+	    }
+	}
+	input[i] = min[i];
+    }
+}
+
+// the n points are given by their index on each axis of the grid
+void getGridValuesFromEquation(int **grids, float **outputs, int n)
+{
+    if (Equation.getGridValues != NULL) {
+	Equation.getGridValues(Equation.tables, grids, outputs, n);
+	return;
+    }
+    Lanes value[Equation.length];
+    for (int first = 0; first < n; first += LANES) {
+	int count = n - first < LANES ? n - first : LANES;
+	runGridLanes(grids, first, count, value);
+	for (int i = 0; i < Equation.output; i++)
+	    memcpy(&outputs[i][first], &value[Equation.roots[i]], 
+		   count * sizeof(float));
+    }
 }
 
 void freeEquation()
 {
-    destroyStack(Equation.stack);
-    destroyState(Equation.state);
-    for (int i = 0; i < Equation.output; i++)
-	free(Equation.equation[i]);
-    free(Equation.equation);
+    freeTables();
+    free(Equation.nodes);
+    free(Equation.roots);
+    Equation.nodes = NULL;
+    Equation.roots = NULL;
+    if (Equation.native != NULL)
+	closeNative(Equation.native);
+    Equation.native = NULL;
+    Equation.getValues = NULL;
+    Equation.getGridValues = NULL;
 }
@@ -44,6 +44,20 @@ static void projectCoord(Lens *l, const Point *OA, float depth, Coord *S)
 	depth + sH / 2;
 }
 
+// the pixel of A and its depth, 0 when A is not beyond the nearplan
+int projectDepth(Lens *l, const Point *A, Coord *S, float *depth)
+{
+    Point OA;
+    Frame *p = getPosition(l);
+
+    diffPoint(A, &p->O, &OA);
+    *depth = scalarProduct(&p->j, &OA);
+    if (*depth <= getNearplan(l))
+	return 0;
+    projectCoord(l, &OA, *depth, S);
+    return 1;
+}
+
 void projectVertex(Lens *l, const Point *A, const Color *color)
 {
     Point OA;
@@ -303,3 +317,23 @@ void projectTriangle(Lens *l, const Point *A, const Point *B, const Point *C,
 			 normalC, normalA, normalB);
     }
 }
+
+// the quad of an impostor, drawn unlit when it is beyond the nearplan
+void projectSprite(Lens *l, const Point *A, const Point *B, const Point *C,
+		   Texture *sprite, 
+		   const Position *U, const Position *V, const Position *W)
+{
+    Pixel pA, pB, pC;
+    Coord a, b, c;
+    float depthA, depthB, depthC;
+    Color white;
+    setColor(&white, 255, 255, 255);
+    if (!projectDepth(l, A, &a, &depthA) || 
+	!projectDepth(l, B, &b, &depthB) || 
+	!projectDepth(l, C, &c, &depthC))
+	return;
+    setPixel(&pA, &a, depthA, &white, U);
+    setPixel(&pB, &b, depthB, &white, V);
+    setPixel(&pC, &c, depthC, &white, W);
+    drawTriangle(l, sprite, &pA, &pB, &pC);
+}
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <limits.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
@@ -16,9 +18,32 @@
 #include "array.h"
 #include "light.h"
 #include "buffer.h"
+#include "hud.h"
+#include "texture.h"
+#include "instance.h"
+#include "bvh.h"
+#include "lens.h"
+#include "project.h"
+#include "occlusion.h"
 
 #define MAXLENGTH 128
 #define NB_KEYWORDS 6
+#define NB_PLANES 5
+// the growth of the refitted tree over which it is built again
+#define REBUILD 4.
+#define MAXOCCLUDERS 8
+// the share of the lens a solid must cover to occlude the others
+#define OCCLUDERSHARE 16
+#define MAXOCCLUDERFACES 16384
+// the error in pixels over which a finer level is drawn, and the share
+// of it under which a coarser one is
+#define LODPIXELS 1.
+#define LODHYSTERESIS 0.75
+// the solids smaller on the lens, with as many faces at least, are drawn
+// as sprites
+#define IMPOSTORPIXELS 64
+#define IMPOSTORFACES 256
+#define MINSPRITE 8
 
 enum {SCREENWIDTH, SCREENHEIGHT, BACKGROUND, UNTEXTURED, MULTIMEDIA, CAMERA};
 
@@ -29,9 +54,23 @@ static struct {
     int nbLight;
     int lightSize;
 
-    Solid **solidBuffer;
-    int nbSolid;
-    int solidSize;
+    Instance **instanceBuffer;
+    int nbInstance;
+    int instanceSize;
+    // the tint of the instance being drawn, on its lighting
+    Color tint;
+    // over the boxes of the instances, built again when they are added
+    // or removed and refitted before each use
+    Bvh *bvh;
+    Box *boxes;
+    float builtArea;
+    int *visible;
+    int nbVisible;
+    int selected;
+    Color selectedTint;
+    int occlusionCulling;
+    Occlusion *occlusion;
+    int impostors;
 
     Camera *camera;
 } scene;
@@ -48,25 +87,242 @@ static void remove_space(char *buf)
     }
 }
 
-static void addSolidToScene(Solid *solid)
+static void addInstanceToScene(Instance *instance)
 {
-    addElementToBuffer(solid, scene.solidBuffer,
-		       &scene.solidSize, &scene.nbSolid);
-    if (solid)
-	calculateOriginSolid(solid);
+    addElementToBuffer(instance, &scene.instanceBuffer,
+		       &scene.instanceSize, &scene.nbInstance);
+    freeBvh(scene.bvh);
+    scene.bvh = NULL;
+}
+
+static void updateBvhScene(void)
+{
+    scene.boxes = realloc(scene.boxes, (scene.nbInstance + 1) * sizeof(Box));
+    scene.visible = realloc(scene.visible, 
+			    (scene.nbInstance + 1) * sizeof(int));
+    for (int i = 0; i < scene.nbInstance; i++) {
+	Instance *I = scene.instanceBuffer[i];
+	getBoxSolid(getSolidInstance(I), getModelInstance(I), 
+		    &scene.boxes[i]);
+    }
+    if (scene.bvh && scene.bvh->numNodes > 0) {
+	refitBvh(scene.bvh, scene.boxes);
+	if (areaBox(&scene.bvh->nodes[0].box) > REBUILD * scene.builtArea) {
+	    freeBvh(scene.bvh);
+	    scene.bvh = NULL;
+	}
+    }
+    if (scene.bvh == NULL) {
+	scene.bvh = buildBvh(scene.boxes, scene.nbInstance);
+	scene.builtArea = scene.nbInstance > 0 ? 
+	    areaBox(&scene.bvh->nodes[0].box) : 0.;
+    }
+}
+
+// the half-spaces in front of the nearplan and inside the fields of view
+static void getFrustumScene(Lens *l, Plane *planes)
+{
+    Frame *p = getPosition(l);
+    float tw = tan(getHfov(l) / 2.);
+    float th = tan(getWfov(l) / 2.);
+    planes[0].n = p->j;
+    setPoint(&planes[1].n, tw * p->j.x - p->i.x, tw * p->j.y - p->i.y, 
+	     tw * p->j.z - p->i.z);
+    setPoint(&planes[2].n, tw * p->j.x + p->i.x, tw * p->j.y + p->i.y, 
+	     tw * p->j.z + p->i.z);
+    setPoint(&planes[3].n, th * p->j.x - p->k.x, th * p->j.y - p->k.y, 
+	     th * p->j.z - p->k.z);
+    setPoint(&planes[4].n, th * p->j.x + p->k.x, th * p->j.y + p->k.y, 
+	     th * p->j.z + p->k.z);
+    for (int i = 0; i < NB_PLANES; i++)
+	planes[i].d = -scalarProduct(&planes[i].n, &p->O);
+    planes[0].d -= getNearplan(l);
+}
+
+static void addVisibleScene(void *data, int item)
+{
+    scene.visible[scene.nbVisible++] = item;
+}
+
+static inline int min(int a, int b)
+{
+    return (a < b) ? a : b;
+}
+
+static inline int max(int a, int b)
+{
+    return (a > b) ? a : b;
+}
+
+// the rectangle of the box on the lens and its nearest depth, 0 when
+// the box reaches the nearplan
+static int projectBoxScene(Lens *l, const Box *box, Coord *low, Coord *high,
+			   float *depth)
+{
+    setCoord(low, INT_MAX, INT_MAX);
+    setCoord(high, INT_MIN, INT_MIN);
+    *depth = INFINITY;
+    for (int c = 0; c < 8; c++) {
+	Point A;
+	Coord S;
+	float d;
+	setPoint(&A,
+		 c & 1 ? box->high.x : box->low.x,
+		 c & 2 ? box->high.y : box->low.y,
+		 c & 4 ? box->high.z : box->low.z);
+	if (!projectDepth(l, &A, &S, &d))
+	    return 0;
+	setCoord(low, min(low->w, S.w), min(low->h, S.h));
+	setCoord(high, max(high->w, S.w), max(high->h, S.h));
+	*depth = fminf(*depth, d);
+    }
+    return 1;
+}
+
+// the visible solids covering the most of the lens are drawn in the
+// occlusion buffer, the others are dropped when hidden behind them
+static void cullOccludedScene(Lens *l)
+{
+    int sW = getScreenWidth(l);
+    int sH = getScreenHeight(l);
+    int occluders[MAXOCCLUDERS];
+    long areas[MAXOCCLUDERS];
+    int nbOccluders = 0;
+
+    for (int i = 0; i < scene.nbVisible; i++) {
+	int item = scene.visible[i];
+	Coord low, high;
+	float depth;
+	if (getSolidInstance(scene.instanceBuffer[item])->numFaces > 
+	    MAXOCCLUDERFACES || 
+	    !projectBoxScene(l, &scene.boxes[item], &low, &high, &depth))
+	    continue;
+	long area = (long) max(0, min(high.w, sW - 1) - max(low.w, 0) + 1) *
+	    max(0, min(high.h, sH - 1) - max(low.h, 0) + 1);
+	if (area < (long) sW * sH / OCCLUDERSHARE ||
+	    (nbOccluders == MAXOCCLUDERS && 
+	     area <= areas[MAXOCCLUDERS - 1]))
+	    continue;
+	// sorted by decreasing area
+	int j = nbOccluders < MAXOCCLUDERS ? nbOccluders++ : MAXOCCLUDERS - 1;
+	for (; j > 0 && areas[j - 1] < area; j--) {
+	    areas[j] = areas[j - 1];
+	    occluders[j] = occluders[j - 1];
+	}
+	areas[j] = area;
+	occluders[j] = item;
+    }
+    if (nbOccluders == 0)
+	return;
+
+    if (scene.occlusion == NULL)
+	scene.occlusion = initOcclusion();
+    resetOcclusion(scene.occlusion, sW, sH);
+    for (int j = 0; j < nbOccluders; j++) {
+	Instance *I = scene.instanceBuffer[occluders[j]];
+	occludeSolid(l, scene.occlusion, getSolidInstance(I), 
+		     getModelInstance(I));
+    }
+
+    int nbVisible = 0;
+    for (int i = 0; i < scene.nbVisible; i++) {
+	int item = scene.visible[i];
+	int occluder = 0;
+	for (int j = 0; j < nbOccluders; j++)
+	    occluder |= occluders[j] == item;
+	Coord low, high;
+	float depth;
+	if (occluder || 
+	    !projectBoxScene(l, &scene.boxes[item], &low, &high, &depth) ||
+	    !isOccludedRect(scene.occlusion, &low, &high, depth))
+	    scene.visible[nbVisible++] = item;
+    }
+    scene.nbVisible = nbVisible;
+}
+
+static float getLodErrorScene(const Solid *solid, int lod, float scale)
+{
+    return solid->lods[lod].error * scale;
+}
+
+// the coarsest level whose error stays under a pixel on the lens, kept
+// from the last frame while it is within the hysteresis
+static int selectLodScene(Lens *l, int lens, int item)
+{
+    Instance *I = scene.instanceBuffer[item];
+    const Solid *solid = getSolidInstance(I);
+    Coord low, high;
+    float depth;
+    if (solid->numLods < 2 || 
+	!projectBoxScene(l, &scene.boxes[item], &low, &high, &depth))
+	return 0;
+    const Frame *m = getModelInstance(I);
+    float scale = fmaxf(normPoint(&m->i), 
+			fmaxf(normPoint(&m->j), normPoint(&m->k))) * 
+	getScreenWidth(l) / (2. * tan(getHfov(l) / 2.)) / depth;
+    int lod = getLodInstance(I, lens);
+    if (lod >= solid->numLods)
+	lod = solid->numLods - 1;
+    while (lod > 0 && getLodErrorScene(solid, lod, scale) > LODPIXELS)
+	lod--;
+    while (lod + 1 < solid->numLods && 
+	   getLodErrorScene(solid, lod + 1, scale) < 
+	   LODPIXELS * LODHYSTERESIS)
+	lod++;
+    setLodInstance(I, lens, lod);
+    return lod;
+}
+
+// the instance drawn through its sprite when it is far and detailed
+// enough, 0 when it is to be drawn as a solid
+static int drawImpostorScene(Lens *l, int lens, int item, int lod)
+{
+    Instance *I = scene.instanceBuffer[item];
+    Solid *solid = getSolidInstance(I);
+    const Box *box = &scene.boxes[item];
+    int numFaces = lod < solid->numLods ? solid->lods[lod].numFaces : 
+	solid->numFaces;
+    Point center, d;
+    setPoint(&center, (box->low.x + box->high.x) / 2., 
+	     (box->low.y + box->high.y) / 2., 
+	     (box->low.z + box->high.z) / 2.);
+    diffPoint(&box->high, &center, &d);
+    float radius = normPoint(&d);
+    float distance = distancePoint(&center, &getPosition(l)->O);
+    if (numFaces < IMPOSTORFACES || 
+	distance - radius <= getNearplan(l))
+	return 0;
+    float side = 2. * radius * getScreenWidth(l) / 
+	(2. * tan(getHfov(l) / 2.)) / distance;
+    Impostor *im;
+    if (side > IMPOSTORPIXELS || !(im = getImpostorInstance(I, lens)))
+	return 0;
+
+    int size = MINSPRITE;
+    while (size < side)
+	size *= 2;
+    if (!isValidImpostor(im, &getPosition(l)->O, &center, 
+			 getModelInstance(I), &scene.tint, size)) {
+	Lens *sprite = beginImpostor(im, l, &center, radius, size, 
+				     getModelInstance(I), &scene.tint);
+	drawSolid(sprite, solid, getModelInstance(I), lod);
+	endImpostor(im);
+    }
+    drawImpostor(l, im);
+    return 1;
 }
 
 static void addLightToScene(Light *light)
 {
-    addElementToBuffer(light, scene.lightBuffer, 
+    addElementToBuffer(light, &scene.lightBuffer, 
 		       &scene.lightSize, &scene.nbLight);
 }
 
-static void freeSolidBuffer()
+static void freeInstanceBuffer()
 {
-    for(int i = 0; i < scene.nbSolid; i++)
-	freeSolid(scene.solidBuffer[i]);
-    free(scene.solidBuffer);
+    for(int i = 0; i < scene.nbInstance; i++)
+	freeInstance(scene.instanceBuffer[i]);
+    free(scene.instanceBuffer);
 }
 
 static void freeLightBuffer()
@@ -81,12 +337,24 @@ void initScene(void)
     Color background;
     Color untextured;
     int screenWidth, screenHeight;
+    int compression;
+    int quantization;
+    int occlusion;
+    int impostors;
     initFrame(&scene.origin);
     char *fileName = "config/config.txt";
     scene.camera = NULL;
-    scene.nbSolid = 0;
-    scene.solidSize = 4;
-    scene.solidBuffer = malloc(scene.solidSize * sizeof(Solid*));
+    scene.nbInstance = 0;
+    scene.instanceSize = 4;
+    scene.instanceBuffer = malloc(scene.instanceSize * sizeof(Instance*));
+    setColor(&scene.tint, 255, 255, 255);
+    scene.bvh = NULL;
+    scene.boxes = NULL;
+    scene.visible = NULL;
+    scene.selected = -1;
+    scene.occlusionCulling = 0;
+    scene.occlusion = NULL;
+    scene.impostors = 0;
     scene.nbLight = 0;
     scene.lightSize = 4;
     scene.lightBuffer = malloc(scene.lightSize * sizeof(Light*));
@@ -129,6 +397,18 @@ void initScene(void)
 	    else if (strcmp(str, "camera") == 0 &&
 		     fscanf(file, "%s", camera) == 1)
 		check[CAMERA]++;
+	    else if (strcmp(str, "textureCompression") == 0 &&
+		     fscanf(file, "%d", &compression) == 1)
+		setCompressionTexture(compression);
+	    else if (strcmp(str, "vertexQuantization") == 0 &&
+		     fscanf(file, "%d", &quantization) == 1)
+		setQuantizationSolid(quantization);
+	    else if (strcmp(str, "occlusionCulling") == 0 &&
+		     fscanf(file, "%d", &occlusion) == 1)
+		scene.occlusionCulling = occlusion;
+	    else if (strcmp(str, "impostors") == 0 &&
+		     fscanf(file, "%d", &impostors) == 1)
+		scene.impostors = impostors;
 	}
 	fclose(file);
     }
@@ -150,13 +430,18 @@ void initScene(void)
 	scene.camera = initCamera(camera);
     }
     refreshCamera(scene.camera, screenWidth, screenHeight);
+    initHud();
 }
 
 void removeSolidFromScene()
 {
-    if(scene.nbSolid > 0) {
+    if(scene.nbInstance > 0) {
 	printf("Solid successfully removed\n");
-	freeSolid(scene.solidBuffer[--scene.nbSolid]);
+	freeInstance(scene.instanceBuffer[--scene.nbInstance]);
+	if (scene.selected == scene.nbInstance)
+	    scene.selected = -1;
+	freeBvh(scene.bvh);
+	scene.bvh = NULL;
     }
 }
 
@@ -170,9 +455,16 @@ void askSolidForScene(void)
     add_history(buf);
     buf = readline("Bitmap path: ");
     remove_space(buf);    
-    addSolidToScene(loadSolid(objstr, buf));
+    Instance *instance = loadInstance(objstr, buf);
     free(objstr);
     add_history(buf);
+    // the same files again place a copy of the loaded solid
+    buf = readline("Position: ");
+    Point O;
+    if (instance && sscanf(buf, "%f %f %f", &O.x, &O.y, &O.z) == 3)
+	translateInstance(instance, O.x, O.y, O.z);
+    add_history(buf);
+    addInstanceToScene(instance);
 }
     
 void drawScene(void)
@@ -181,36 +473,130 @@ void drawScene(void)
     int nbLens = getNbLens(C);
     Color color;
 
+    beginFrameHud();
     resetCamera(C);
     resetDisplay();
+    updateBvhScene();
     for (int j = 0; j < nbLens; j++) {
-	if (getStateCamera(C, DRAW))
-	    for (int i = 0; i < scene.nbSolid; i++)
-		drawSolid(getLensOfCamera(C, j), scene.solidBuffer[i]);
-	if (getStateCamera(C, WIREFRAME))
-	    for (int i = 0; i < scene.nbSolid; i++)
-		wireframeSolid(getLensOfCamera(C, j), scene.solidBuffer[i], 
+	Plane planes[NB_PLANES];
+	getFrustumScene(getLensOfCamera(C, j), planes);
+	scene.nbVisible = 0;
+	cullBvh(scene.bvh, planes, NB_PLANES, addVisibleScene, NULL);
+	if (scene.occlusionCulling)
+	    cullOccludedScene(getLensOfCamera(C, j));
+	for (int i = 0; i < scene.nbVisible; i++) {
+	    Instance *I = scene.instanceBuffer[scene.visible[i]];
+	    Solid *solid = getSolidInstance(I);
+	    Frame *model = getModelInstance(I);
+	    if (getStateCamera(C, DRAW)) {
+		Lens *l = getLensOfCamera(C, j);
+		int lod = selectLodScene(l, j, scene.visible[i]);
+		scene.tint = *getTintInstance(I);
+		if (!scene.impostors || 
+		    !drawImpostorScene(l, j, scene.visible[i], lod))
+		    drawSolid(l, solid, model, lod);
+		setColor(&scene.tint, 255, 255, 255);
+	    }
+	    if (getStateCamera(C, WIREFRAME))
+		wireframeSolid(getLensOfCamera(C, j), solid, model, 
 			       setColor(&color, 255, 0, 0));
-	if (getStateCamera(C, NORMAL))
-	    for (int i = 0; i < scene.nbSolid; i++)
-		normalSolid(getLensOfCamera(C, j), scene.solidBuffer[i], 
+	    if (getStateCamera(C, SILHOUETTE))
+		silhouetteSolid(getLensOfCamera(C, j), solid, model, 
+				setColor(&color, 255, 255, 0));
+	    if (getStateCamera(C, NORMAL))
+		normalSolid(getLensOfCamera(C, j), solid, model, 
 			    setColor(&color, 0, 255, 0));
-	if (getStateCamera(C, VERTEX))
-	    for (int i = 0; i < scene.nbSolid; i++)
-		vertexSolid(getLensOfCamera(C, j), scene.solidBuffer[i], 
+	    if (getStateCamera(C, VERTEX))
+		vertexSolid(getLensOfCamera(C, j), solid, model, 
 			    setColor(&color, 0, 0, 255));
+	}
 	if (getStateCamera(C, FRAME))
 	    drawFrame(getLensOfCamera(C, j), &scene.origin);
     }
+    if (getStateCamera(C, HUD))
+	drawHud();
     blitDisplay();
+    endFrameHud();
+}
+
+typedef struct Pick {
+    float distance;
+    int face;
+} Pick;
+
+static float hitInstanceScene(void *data, int item, const Point *O, 
+			      const Point *d)
+{
+    Pick *pick = data;
+    Instance *I = scene.instanceBuffer[item];
+    int face = -1;
+    float t = raySolid(getSolidInstance(I), getModelInstance(I), O, d, 
+		       &face);
+    if (t < pick->distance) {
+	pick->distance = t;
+	pick->face = face;
+    }
+    return t;
+}
+
+// selects the solid under the pixel (x, y) of the window, through the
+// lens drawn there
+void pickScene(int x, int y)
+{
+    Camera *C = scene.camera;
+    Lens *l = NULL;
+    for (int j = 0; j < getNbLens(C); j++) {
+	Lens *m = getLensOfCamera(C, j);
+	int w = x - getWidthPosition(m);
+	int h = y - getHeightPosition(m);
+	if (w >= 0 && w < getScreenWidth(m) && 
+	    h >= 0 && h < getScreenHeight(m))
+	    l = m;
+    }
+    if (l == NULL)
+	return;
+
+    // projectCoord backwards, at a depth of 1
+    Frame *p = getPosition(l);
+    int sW = getScreenWidth(l);
+    int sH = getScreenHeight(l);
+    float a = (x - getWidthPosition(l) - sW / 2) * 
+	2. * tan(getHfov(l) / 2.) / sW;
+    float b = -(y - getHeightPosition(l) - sH / 2) * 
+	2. * tan(getWfov(l) / 2.) / sH;
+    Point d;
+    setPoint(&d,
+	     p->j.x + a * p->i.x + b * p->k.x,
+	     p->j.y + a * p->i.y + b * p->k.y,
+	     p->j.z + a * p->i.z + b * p->k.z);
+
+    updateBvhScene();
+    Pick pick = {INFINITY, -1};
+    int item = -1;
+    rayBvh(scene.bvh, &p->O, &d, hitInstanceScene, &pick, &item);
+    if (scene.selected != -1)
+	setTintInstance(scene.instanceBuffer[scene.selected], 
+			&scene.selectedTint);
+    scene.selected = item;
+    if (item == -1) {
+	printf("No solid picked\n");
+	return;
+    }
+    printf("Picked face %d of solid %d at %.2f\n", pick.face, item, 
+	   pick.distance);
+    Instance *I = scene.instanceBuffer[item];
+    Color highlight;
+    scene.selectedTint = *getTintInstance(I);
+    setTintInstance(I, filterColor(setColor(&highlight, 255, 160, 160), 
+				   &scene.selectedTint));
 }
 
 void handleArgumentScene(int argc, char *argv[])
 {
     if (argc == 2)
-	addSolidToScene(loadSolid(argv[1], NULL));
+	addInstanceToScene(loadInstance(argv[1], NULL));
     else if (argc == 3)
-	addSolidToScene(loadSolid(argv[1], argv[2]));
+	addInstanceToScene(loadInstance(argv[1], argv[2]));
 }
 
 void calculateLightScene(const Point *A, const Point *nA, Color *c)
@@ -221,6 +607,7 @@ void calculateLightScene(const Point *A, const Point *nA, Color *c)
 	calculateLight(scene.lightBuffer[i], A, nA, &tmp);
 	sumColor(c, &tmp, c);
     }
+    filterColor(c, &scene.tint);
 }
 
 void resizeCameraScene(int screenWidth, int screenHeight)
@@ -246,7 +633,12 @@ void switchStateCameraScene(int state)
 
 void freeScene(void)
 {
-    freeSolidBuffer();
+    freeInstanceBuffer();
+    freeBvh(scene.bvh);
+    free(scene.boxes);
+    free(scene.visible);
+    freeOcclusion(scene.occlusion);
+    freeTransformSolid();
     freeLightBuffer();
     freeCamera(scene.camera);
     freeDisplay();
@@ -12,10 +12,21 @@
 #include "frame.h"
 #include "texture.h"
 #include "build.h"
+#include "cache.h"
+#include "mapping.h"
+#include "occlusion.h"
+#include "lod.h"
 
 #define MAXLENGTH 256
 #define EPSILON 0.001
 
+static int quantization;
+static Vertex *transformed;
+static int numTransformed;
+static const Solid *transformedSolid;
+static Frame transformedModel;
+static int numValid;
+
 static void getExtension(const char *file, char *ext)
 {
     if (!file)
@@ -28,118 +39,290 @@ static void getExtension(const char *file, char *ext)
     ext[j] = '\0';
 }
 
+// the mean and the bounds of the points, each counted once however many
+// vertices were welded from it
+void calculateOriginSolid(Solid *solid)
+{
+    int numPoints = 0;
+    for (int i = 0; i < solid->numVertices; i++)
+	if (solid->points[i] >= numPoints)
+	    numPoints = solid->points[i] + 1;
+    char *seen = calloc(numPoints, 1);
+    Point mean;
+    setPoint(&mean, 0., 0., 0.);
+    setBox(&solid->bounds);
+    int count = 0;
+    for (int i = 0; i < solid->numVertices; i++) {
+	if (seen[solid->points[i]])
+	    continue;
+	seen[solid->points[i]] = 1;
+	Vertex v;
+	getVertexBuild(solid, i, &v);
+	growBox(&solid->bounds, &v.point);
+	mean.x += v.point.x;
+	mean.y += v.point.y;
+	mean.z += v.point.z;
+	count++;
+    }
+    free(seen);
+    mean.x /= count;
+    mean.y /= count;
+    mean.z /= count;
+    solid->origin = mean;
+}
+
 Solid *loadSolid(const char *fileName, const char *bmpName)
 {
     char ext[MAXLENGTH] = {0};
     getExtension(fileName, ext);
-    if (strcmp(ext, ".obj") == 0)
-	return loadObject(fileName, bmpName);
+    Solid *solid = NULL;
+    if (strcmp(ext, ".obj") == 0) {
+	solid = loadCache(fileName, bmpName);
+	if (solid == NULL && (solid = loadObject(fileName, bmpName))) {
+	    simplifyLod(solid);
+	    saveCache(fileName, solid);
+	}
+    }
+    // equations are not cached, their levels would be rebuilt at each load
     else if (strcmp(ext, ".eq") == 0)
-	return loadEquation(fileName, bmpName);
-    fprintf(stderr, "Extension non reconnue\n");
-    return NULL;
+	solid = loadEquation(fileName, bmpName);
+    else {
+	fprintf(stderr, "Extension non reconnue\n");
+	return NULL;
+    }
+    if (solid) {
+	calculateOriginSolid(solid);
+	if (quantization)
+	    packBuild(solid);
+    }
+    return solid;
 }
 
-void calculateOriginSolid(Solid *solid)
+void setQuantizationSolid(int enabled)
 {
-    for (int i = 0; i < solid->numVertices; i++) {
-	solid->origin.x += solid->vertices[i].x;
-	solid->origin.y += solid->vertices[i].y;
-	solid->origin.z += solid->vertices[i].z;
+    quantization = enabled;
+}
+
+// the first n vertices in the scene, decoded and moved by the model into
+// a buffer shared by the solids; the overlays drawn for the same solid
+// and model then reuse them
+static const Vertex *transformSolid(const Solid *solid, const Frame *model,
+				    int n)
+{
+    if (solid == transformedSolid && n <= numValid &&
+	memcmp(model, &transformedModel, sizeof(Frame)) == 0)
+	return transformed;
+    if (n > numTransformed) {
+	transformed = realloc(transformed, n * sizeof(Vertex));
+	numTransformed = n;
+    }
+    Frame normalModel;
+    getNormalFrame(model, &normalModel);
+    for (int i = 0; i < n; i++) {
+	Vertex v;
+	getVertexBuild(solid, i, &v);
+	getAbsolutePointFromFrame(model, &v.point, 
+				  &transformed[i].point);
+	getAbsolutePointFromFrame(&normalModel, &v.normal, 
+				  &transformed[i].normal);
+	transformed[i].coord = v.coord;
     }
-    solid->origin.x /= solid->numVertices;
-    solid->origin.y /= solid->numVertices;
-    solid->origin.z /= solid->numVertices;
+    transformedSolid = solid;
+    transformedModel = *model;
+    numValid = n;
+    return transformed;
 }
 
+void freeTransformSolid(void)
+{
+    free(transformed);
+    transformed = NULL;
+    numTransformed = 0;
+    transformedSolid = NULL;
+}
 
 Point *getOriginSolid(Solid *solid)
 {
     return &solid->origin;
 }
 
-void translateSolid(Solid *solid, float x, float y, float z)
+void vertexSolid(Lens *l, const Solid *solid, const Frame *model,
+		 const Color *color)
 {
-    for (int i = 0; i < solid->numVertices; i++)
-	translatePoint(&solid->vertices[i], x, y, z);
-    translatePoint(&solid->origin, x, y, z);    
+    const Vertex *vertices = transformSolid(solid, model, solid->numVertices);
+    for (int i = 0; i < solid->numVertices; ++i)
+	projectVertex(l, &vertices[i].point, color);
 }
-
-void scaleSolid(Solid *solid, const Point *O, float scale)
+  
+void wireframeSolid(Lens *l, Solid *solid, const Frame *model,
+		    const Color *color)
 {
-    for (int i = 0; i < solid->numVertices; i++)
-	scalePoint(&solid->vertices[i], O, scale);
-    scalePoint(&solid->origin, O, scale);
+    if (solid->segments == NULL)
+	extractSegmentBuild(solid);
+    const Vertex *vertices = transformSolid(solid, model, solid->numVertices);
+    for (int i = 0; i < solid->numSegments; i++) {
+	projectSegment(l, 
+		       &vertices[solid->segments[i].A].point,
+		       &vertices[solid->segments[i].B].point, 
+		       color);
+    }
 }
 
-void rotSolidXAxis(Solid *solid, const Point *O, float phi)
+static int isFacingSolid(const Solid *solid, const Vertex *vertices, 
+			 int f, const Point *O)
 {
-    for (int i = 0; i < solid->numVertices; i++)
-	rotPointXAxis(&solid->vertices[i], O, phi);
-    rotPointXAxis(&solid->origin, O, phi);
+    const Point *A = &vertices[getIndexBuild(solid, 3 * f)].point;
+    const Point *B = &vertices[getIndexBuild(solid, 3 * f + 1)].point;
+    const Point *C = &vertices[getIndexBuild(solid, 3 * f + 2)].point;
+    Point AB, AC, n, AO;
+    diffPoint(B, A, &AB);
+    diffPoint(C, A, &AC);
+    pointProduct(&AB, &AC, &n);
+    diffPoint(O, A, &AO);
+    return scalarProduct(&n, &AO) > 0;
 }
 
-void rotSolidYAxis(Solid *solid, const Point *O, float rho)
+// draws the borders, the edges between a front and a back face and the
+// creases seen from the lens
+void silhouetteSolid(Lens *l, Solid *solid, const Frame *model,
+		     const Color *color)
 {
-    for (int i = 0; i < solid->numVertices; i++)
-	rotPointYAxis(&solid->vertices[i], O, rho);
-    rotPointXAxis(&solid->origin, O, rho);
+    if (solid->halfEdges == NULL)
+	linkHalfEdgeBuild(solid);
+    const Vertex *vertices = transformSolid(solid, model, solid->numVertices);
+    const Point *O = &getPosition(l)->O;
+
+    for (int h = 0; h < 3 * solid->numFaces; h++) {
+	const HalfEdge *e = &solid->halfEdges[h];
+	if (e->twin != -1 && e->twin < h)
+	    continue;
+	if (e->twin != -1) {
+	    int front = isFacingSolid(solid, vertices, h / 3, O);
+	    int twinFront = isFacingSolid(solid, vertices, e->twin / 3, O);
+	    if (front == twinFront && !(e->crease && front))
+		continue;
+	}
+	int next = h - h % 3 + (h + 1) % 3;
+	projectSegment(l, 
+		       &vertices[getIndexBuild(solid, h)].point,
+		       &vertices[getIndexBuild(solid, next)].point,
+		       color);
+    }
 }
 
-void rotSolidZAxis(Solid *solid, const Point *O, float theta)
+void normalSolid(Lens *l, const Solid *solid, const Frame *model,
+		 const Color *color)
 {
-    for (int i = 0; i < solid->numVertices; i++)
-	rotPointZAxis(&solid->vertices[i], O, theta);
-    rotPointXAxis(&solid->origin, O, theta);
+    const Vertex *vertices = transformSolid(solid, model, solid->numVertices);
+    for (int i = 0; i < solid->numVertices; i++) {
+	const Vertex *v = &vertices[i];
+	Point tmp;
+	Point normal = v->normal;
+
+	setPoint(&tmp, 0., 0., 0.);
+	scalePoint(&normal, &tmp, 0.1);
+	sumPoint(&v->point, &normal, &tmp);
+	projectSegment(l, &v->point, &tmp, color);
+    }
 }
 
-void vertexSolid(Lens *l, const Solid *solid, const Color *color)
+// the level lod when the solid has it, the full solid otherwise
+void drawSolid(Lens *l, const Solid * solid, const Frame *model, int lod)
 {
-    for (int i = 0; i < solid->numVertices; ++i)
-	projectVertex(l, &solid->vertices[i], color);
+    int first = 0;
+    int numFaces = solid->numFaces;
+    int numVertices = solid->numVertices;
+    if (lod > 0 && lod < solid->numLods) {
+	first = solid->lods[lod].firstFace;
+	numFaces = solid->lods[lod].numFaces;
+	numVertices = solid->lods[lod].numVertices;
+    }
+    const Vertex *vertices = transformSolid(solid, model, numVertices);
+    for (int i = first; i < first + numFaces; i++) {
+	const Vertex *A = &vertices[getIndexBuild(solid, 3 * i)];
+	const Vertex *B = &vertices[getIndexBuild(solid, 3 * i + 1)];
+	const Vertex *C = &vertices[getIndexBuild(solid, 3 * i + 2)];
+	projectTriangle(l, &A->point, &B->point, &C->point, solid->texture,
+			&A->coord, &B->coord, &C->coord,
+			&A->normal, &B->normal, &C->normal);
+    }
 }
-  
-void wireframeSolid(Lens *l, const Solid *solid, const Color *color)
+
+static float hitFace(void *data, int f, const Point *O, const Point *d)
 {
-    for (int i = 0; i < solid->numSegments; i++) {
-	projectSegment(l, 
-		       &solid->vertices[solid->segments[i].A],
-		       &solid->vertices[solid->segments[i].B], 
-		       color);
-    }
+    const Solid *solid = data;
+    Vertex A, B, C;
+    getVertexBuild(solid, getIndexBuild(solid, 3 * f), &A);
+    getVertexBuild(solid, getIndexBuild(solid, 3 * f + 1), &B);
+    getVertexBuild(solid, getIndexBuild(solid, 3 * f + 2), &C);
+    Point AB, AC, p, AO, q;
+    diffPoint(&B.point, &A.point, &AB);
+    diffPoint(&C.point, &A.point, &AC);
+    pointProduct(d, &AC, &p);
+    float det = scalarProduct(&AB, &p);
+    if (fabsf(det) < 1e-12)
+	return INFINITY;
+    diffPoint(O, &A.point, &AO);
+    float u = scalarProduct(&AO, &p) / det;
+    if (u < 0. || u > 1.)
+	return INFINITY;
+    pointProduct(&AO, &AB, &q);
+    float v = scalarProduct(d, &q) / det;
+    if (v < 0. || u + v > 1.)
+	return INFINITY;
+    float t = scalarProduct(&AC, &q) / det;
+    return t > 0. ? t : INFINITY;
 }
 
-void normalSolid(Lens *l, const Solid *solid, const Color *color)
+// the faces beyond the nearplan hide what is behind them
+void occludeSolid(Lens *l, Occlusion *o, const Solid *solid, 
+		  const Frame *model)
 {
+    const Vertex *vertices = transformSolid(solid, model, solid->numVertices);
     for (int i = 0; i < solid->numFaces; i++) {
-	Face *f = &solid->faces[i];
-	for (int k = 0; k < 3; k++) {
-	    Point tmp;
-	    int point = f->vertices[k].point;
-	    Point normal = solid->normals[f->vertices[k].normal];
-
-	    setPoint(&tmp, 0., 0., 0.);
-	    scalePoint(&normal, &tmp, 0.1);
-	    sumPoint(&solid->vertices[point], &normal, &tmp);
-	    projectSegment(l, &solid->vertices[point], &tmp, color);
+	Coord c[3];
+	float depth[3];
+	int front = 1;
+	for (int k = 0; k < 3 && front; k++) {
+	    const Vertex *v = &vertices[getIndexBuild(solid, 3 * i + k)];
+	    front = projectDepth(l, &v->point, &c[k], &depth[k]);
 	}
+	if (front)
+	    occludeTriangle(o, &c[0], depth[0], &c[1], depth[1], 
+			    &c[2], depth[2]);
     }
 }
 
-void drawSolid(Lens *l, const Solid * solid)
+// the distance along d to the nearest face hit, INFINITY when none is;
+// the ray is followed in the coordinates of the solid, where the
+// distance stays the same
+float raySolid(Solid *solid, const Frame *model, const Point *O, 
+	       const Point *d, int *face)
 {
-    for (int i = 0; i < solid->numFaces; i++)
-	projectTriangle(l,
-			&solid->vertices[solid->faces[i].vertices[0].point],
-			&solid->vertices[solid->faces[i].vertices[1].point],
-			&solid->vertices[solid->faces[i].vertices[2].point],
-			solid->texture,
-			&solid->coords[solid->faces[i].vertices[0].coord],
-			&solid->coords[solid->faces[i].vertices[1].coord],
-			&solid->coords[solid->faces[i].vertices[2].coord],
-			&solid->normals[solid->faces[i].vertices[0].normal],
-			&solid->normals[solid->faces[i].vertices[1].normal],
-			&solid->normals[solid->faces[i].vertices[2].normal]);
+    if (solid->bvh == NULL)
+	linkBvhBuild(solid);
+    Point localO, localD;
+    getRelativePointFromFrame(model, O, &localO);
+    getRelativeVectorFromFrame(model, d, &localD);
+    return rayBvh(solid->bvh, &localO, &localD, hitFace, solid, face);
+}
+
+// the box in the scene around the vertices moved by the model
+void getBoxSolid(const Solid *solid, const Frame *model, Box *box)
+{
+    const Box *local = &solid->bounds;
+    setBox(box);
+    if (solid->numVertices == 0)
+	return;
+    for (int c = 0; c < 8; c++) {
+	Point A, B;
+	setPoint(&A,
+		 c & 1 ? local->high.x : local->low.x,
+		 c & 2 ? local->high.y : local->low.y,
+		 c & 4 ? local->high.z : local->low.z);
+	getAbsolutePointFromFrame(model, &A, &B);
+	growBox(box, &B);
+    }
 }
 
 void drawFrame(Lens *l, Frame *frame)
@@ -152,11 +335,20 @@ void drawFrame(Lens *l, Frame *frame)
 
 void freeSolid(Solid *solid)
 {
+    if (solid == transformedSolid)
+	transformedSolid = NULL;
     freeTexture(solid->texture);
-    free(solid->vertices);
-    free(solid->normals);
-    free(solid->coords);
     free(solid->segments);
-    free(solid->faces);
+    free(solid->halfEdges);
+    freeBvh(solid->bvh);
+    free(solid->packed);
+    if (solid->mapping) {
+	unmapFile(solid->mapping, solid->mappingSize);
+    } else {
+	free(solid->vertices);
+	free(solid->points);
+	free(solid->indices);
+	free(solid->lods);
+    }
     free(solid);
 }
@@ -1,40 +1,459 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <math.h>
 
 #include "position.h"
 #include "color.h"
-#include "SDL/SDL.h"
+#include "image.h"
 
+// texels are stored as RGBA8 in 4x4 tiles: one tile fills a 64 bytes cache
+// line, so that neighbouring texels in both directions share a line
+#define TILESHIFT 2
+#define TILESIZE (1 << TILESHIFT)
+#define TILEMASK (TILESIZE - 1)
+// texture coordinates are wrapped in 16.16 fixed point
+#define FIXEDSHIFT 16
+#define FIXEDONE (1 << FIXEDSHIFT)
+#define FIXEDMASK (FIXEDONE - 1)
+#define MAXLEVELS 16
+// decoded blocks kept by each thread, must be a power of two
+#define CACHESIZE 64
+
+// BC1 block: two RGB565 end points and a 2 bits palette index per texel
+typedef struct Block {
+    uint16_t color0;
+    uint16_t color1;
+    uint32_t indices;
+} Block;
+
+typedef struct Level {
+    int width;
+    int height;
+    int tilesPerRow;
+    union {
+	uint32_t *texels;
+	Block *blocks;
+    };
+} Level;
+
+// the image stays mapped until the texture is first sampled
 typedef struct Texture {
-    SDL_Surface *t;
+    char *name;
+    int references;
+    Image *image;
+    long memory;
+    int compressed;
+    int nbLevels;
+    Level levels[MAXLEVELS];
+    // set on sprites only, the depth of each texel of the first level
+    float *offsets;
 } Texture;
 
-Texture *loadTexture(const char *fileName)
+static int compression = 0;
+
+static __thread struct {
+    const Block *block;
+    uint32_t texels[TILESIZE * TILESIZE];
+} cache[CACHESIZE];
+
+// textures are shared by every solid loading the same file
+static struct {
+    Texture **textureBuffer;
+    int nbTexture;
+    int textureSize;
+    long memory;
+} registry;
+
+static inline int getIndexLevel(const Level *l, int w, int h)
 {
-    SDL_Surface *tmp = SDL_LoadBMP(fileName);
-    if (!tmp)
+    return (((h >> TILESHIFT) * l->tilesPerRow + (w >> TILESHIFT)) 
+	    << (2 * TILESHIFT)) + ((h & TILEMASK) << TILESHIFT) + 
+	(w & TILEMASK);
+}
+
+static long initLevel(Level *l, int width, int height)
+{
+    l->width = width;
+    l->height = height;
+    l->tilesPerRow = (width + TILEMASK) >> TILESHIFT;
+    int tilesPerColumn = (height + TILEMASK) >> TILESHIFT;
+    long size = (long) l->tilesPerRow * tilesPerColumn * 
+	TILESIZE * TILESIZE * sizeof(uint32_t);
+    l->texels = malloc(size);
+    return size;
+}
+
+static uint32_t averageTexels(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    uint32_t r = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+	r |= ((((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + 
+	       ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF) + 2) / 4) 
+	    << shift;
+    return r;
+}
+
+// box filter of the previous level, the last row or column of an odd sized
+// level being reused
+static long reduceLevel(const Level *src, Level *dst)
+{
+    long size = initLevel(dst, src->width > 1 ? src->width / 2 : 1,
+	      src->height > 1 ? src->height / 2 : 1);
+    for (int h = 0; h < dst->height; h++) {
+	int h0 = 2 * h < src->height ? 2 * h : src->height - 1;
+	int h1 = h0 + 1 < src->height ? h0 + 1 : h0;
+	for (int w = 0; w < dst->width; w++) {
+	    int w0 = 2 * w < src->width ? 2 * w : src->width - 1;
+	    int w1 = w0 + 1 < src->width ? w0 + 1 : w0;
+	    dst->texels[getIndexLevel(dst, w, h)] = averageTexels(
+		src->texels[getIndexLevel(src, w0, h0)],
+		src->texels[getIndexLevel(src, w1, h0)],
+		src->texels[getIndexLevel(src, w0, h1)],
+		src->texels[getIndexLevel(src, w1, h1)]);
+	}
+    }
+    return size;
+}
+
+static uint16_t packColor(int r, int g, int b)
+{
+    return (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+}
+
+static uint32_t unpackColor(uint16_t c)
+{
+    int r = c >> 11 & 0x1F;
+    int g = c >> 5 & 0x3F;
+    int b = c & 0x1F;
+    return (r << 3 | r >> 2) | (g << 2 | g >> 4) << 8 | 
+	(b << 3 | b >> 2) << 16 | 0xFFu << 24;
+}
+
+static uint32_t mixColor(uint32_t a, uint32_t b)
+{
+    uint32_t r = 0xFFu << 24;
+    for (int shift = 0; shift < 24; shift += 8)
+	r |= ((2 * (a >> shift & 0xFF) + (b >> shift & 0xFF) + 1) / 3) 
+	    << shift;
+    return r;
+}
+
+static void getPaletteBlock(const Block *b, uint32_t palette[4])
+{
+    palette[0] = unpackColor(b->color0);
+    palette[1] = unpackColor(b->color1);
+    palette[2] = mixColor(palette[0], palette[1]);
+    palette[3] = mixColor(palette[1], palette[0]);
+}
+
+static int distanceTexels(uint32_t a, uint32_t b)
+{
+    int d = 0;
+    for (int shift = 0; shift < 24; shift += 8) {
+	int c = (int) (a >> shift & 0xFF) - (int) (b >> shift & 0xFF);
+	d += c * c;
+    }
+    return d;
+}
+
+// end points are the corners of the bounding box of the tile colors, 
+// inset by 1/16 of its size to reduce the error on the extremes
+static void compressTile(const Level *l, int tile, int nbTexels, 
+			 const int *valid, Block *b)
+{
+    const uint32_t *texels = &l->texels[tile * TILESIZE * TILESIZE];
+    int min[3] = {255, 255, 255};
+    int max[3] = {0, 0, 0};
+    for (int i = 0; i < nbTexels; i++) {
+	for (int k = 0; k < 3; k++) {
+	    int c = texels[valid[i]] >> (8 * k) & 0xFF;
+	    min[k] = c < min[k] ? c : min[k];
+	    max[k] = c > max[k] ? c : max[k];
+	}
+    }
+    for (int k = 0; k < 3; k++) {
+	int inset = (max[k] - min[k]) / 16;
+	min[k] += inset;
+	max[k] -= inset;
+    }
+    b->color0 = packColor(max[0], max[1], max[2]);
+    b->color1 = packColor(min[0], min[1], min[2]);
+    b->indices = 0;
+    if (b->color0 == b->color1)
+	return;
+
+    uint32_t palette[4];
+    getPaletteBlock(b, palette);
+    for (int i = 0; i < nbTexels; i++) {
+	int best = 0;
+	int bestDistance = distanceTexels(texels[valid[i]], palette[0]);
+	for (int j = 1; j < 4; j++) {
+	    int d = distanceTexels(texels[valid[i]], palette[j]);
+	    if (d < bestDistance) {
+		best = j;
+		bestDistance = d;
+	    }
+	}
+	b->indices |= (uint32_t) best << (2 * valid[i]);
+    }
+}
+
+// replaces the texels of a level by BC1 blocks, 8 times smaller
+static long compressLevel(Level *l)
+{
+    int tilesPerColumn = (l->height + TILEMASK) >> TILESHIFT;
+    int nbTiles = l->tilesPerRow * tilesPerColumn;
+    Block *blocks = malloc(nbTiles * sizeof(Block));
+    for (int tile = 0; tile < nbTiles; tile++) {
+	int valid[TILESIZE * TILESIZE];
+	int nbTexels = 0;
+	int w = (tile % l->tilesPerRow) << TILESHIFT;
+	int h = (tile / l->tilesPerRow) << TILESHIFT;
+	for (int i = 0; i < TILESIZE * TILESIZE; i++)
+	    if (w + (i & TILEMASK) < l->width && 
+		h + (i >> TILESHIFT) < l->height)
+		valid[nbTexels++] = i;
+	compressTile(l, tile, nbTexels, valid, &blocks[tile]);
+    }
+    free(l->texels);
+    l->blocks = blocks;
+    return nbTiles * sizeof(Block);
+}
+
+static uint32_t getTexelBlock(const Level *l, int w, int h)
+{
+    const Block *b = &l->blocks[(h >> TILESHIFT) * l->tilesPerRow + 
+				(w >> TILESHIFT)];
+    int i = ((uintptr_t) b / sizeof(Block)) & (CACHESIZE - 1);
+    if (cache[i].block != b) {
+	uint32_t palette[4];
+	getPaletteBlock(b, palette);
+	for (int j = 0; j < TILESIZE * TILESIZE; j++)
+	    cache[i].texels[j] = palette[b->indices >> (2 * j) & 3];
+	cache[i].block = b;
+    }
+    return cache[i].texels[((h & TILEMASK) << TILESHIFT) + (w & TILEMASK)];
+}
+
+static void convertImage(Level *l, const Image *image)
+{
+    for (int h = 0; h < l->height; h++)
+	for (int w = 0; w < l->width; w++)
+	    l->texels[getIndexLevel(l, w, h)] = getPixelImage(image, w, h);
+}
+
+static Texture *findTexture(const char *name)
+{
+    for (int i = 0; i < registry.nbTexture; i++)
+	if (strcmp(registry.textureBuffer[i]->name, name) == 0)
+	    return registry.textureBuffer[i];
+    return NULL;
+}
+
+static void addTextureToRegistry(Texture *texture)
+{
+    if (registry.nbTexture >= registry.textureSize) {
+	registry.textureSize = registry.textureSize ? 
+	    2 * registry.textureSize : 4;
+	registry.textureBuffer = realloc(registry.textureBuffer, 
+					 registry.textureSize * 
+					 sizeof(Texture *));
+    }
+    registry.textureBuffer[registry.nbTexture++] = texture;
+}
+
+static void removeTextureFromRegistry(Texture *texture)
+{
+    for (int i = 0; i < registry.nbTexture; i++) {
+	if (registry.textureBuffer[i] == texture) {
+	    registry.textureBuffer[i] = 
+		registry.textureBuffer[--registry.nbTexture];
+	    registry.memory -= texture->memory;
+	    break;
+	}
+    }
+    if (registry.nbTexture == 0) {
+	free(registry.textureBuffer);
+	registry.textureBuffer = NULL;
+	registry.textureSize = 0;
+    }
+}
+
+// the mapped pixels are converted straight into the tiled layout, then
+// the mip chain is built from them
+static void convertTexture(Texture *texture)
+{
+    texture->memory = initLevel(&texture->levels[0], 
+				getWidthImage(texture->image),
+				getHeightImage(texture->image));
+    convertImage(&texture->levels[0], texture->image);
+    freeImage(texture->image);
+    texture->image = NULL;
+
+    texture->nbLevels = 1;
+    while (texture->nbLevels < MAXLEVELS) {
+	Level *l = &texture->levels[texture->nbLevels - 1];
+	if (l->width == 1 && l->height == 1)
+	    break;
+	texture->memory += reduceLevel(l, l + 1);
+	texture->nbLevels++;
+    }
+    if (texture->compressed) {
+	texture->memory = 0;
+	for (int i = 0; i < texture->nbLevels; i++)
+	    texture->memory += compressLevel(&texture->levels[i]);
+    }
+    registry.memory += texture->memory;
+}
+
+// only the header is read here, pixels are paged in on first use
+static Texture *createTexture(const char *fileName)
+{
+    Image *image = loadImage(fileName);
+    if (!image)
 	return NULL;
     Texture *texture = malloc(sizeof(Texture));
-    texture->t = tmp;
+    texture->image = image;
+    texture->memory = 0;
+    texture->nbLevels = 0;
+    texture->compressed = compression;
+    texture->offsets = NULL;
+    return texture;
+}
+
+Texture *loadTexture(const char *fileName)
+{
+    if (!fileName)
+	return NULL;
+    char path[PATH_MAX];
+    const char *name = realpath(fileName, path) ? path : fileName;
+    Texture *texture = findTexture(name);
+    if (texture) {
+	texture->references++;
+	return texture;
+    }
+    if (!(texture = createTexture(fileName)))
+	return NULL;
+    texture->name = strdup(name);
+    texture->references = 1;
+    addTextureToRegistry(texture);
+    return texture;
+}
+
+// textures loaded afterwards are stored as BC1 blocks, trading some color
+// precision for a 6 times smaller footprint than 24 bits bitmaps
+void setCompressionTexture(int enabled)
+{
+    compression = enabled;
+}
+
+// memory held by the texels of every texture sampled so far, in bytes
+long getMemoryTexture(void)
+{
+    return registry.memory;
+}
+
+// derivatives are expressed in texture coordinates per screen pixel, this
+// must be called before the texture is sampled
+int getLevelTexture(Texture *texture, 
+		    float dudw, float dvdw, float dudh, float dvdh)
+{
+    if (texture->image)
+	convertTexture(texture);
+    float width = texture->levels[0].width;
+    float height = texture->levels[0].height;
+    float rhoW = dudw * dudw * width * width + dvdw * dvdw * height * height;
+    float rhoH = dudh * dudh * width * width + dvdh * dvdh * height * height;
+    float rho = rhoW > rhoH ? rhoW : rhoH;
+    if (!(rho > 1.))
+	return 0;
+    int level = 0.5 * log2f(rho);
+    return level < texture->nbLevels ? level : texture->nbLevels - 1;
+}
+
+// p does not need to be in [0, 1[: the fractional part is kept by masking
+void getPixelTexture(const Texture *texture, int level, const Position *p, 
+		     Color *c)
+{
+    const Level *l = &texture->levels[level];
+    unsigned int u = (int) (p->x * FIXEDONE) & FIXEDMASK;
+    unsigned int v = (int) (p->y * FIXEDONE) & FIXEDMASK;
+    int w = u * l->width >> FIXEDSHIFT;
+    int h = v * l->height >> FIXEDSHIFT;
+    uint32_t texel = texture->compressed ? getTexelBlock(l, w, h) : 
+	l->texels[getIndexLevel(l, w, h)];
+    c->r = texel;
+    c->g = texel >> 8;
+    c->b = texel >> 16;
+}
+
+// a texture of a single level drawn by the impostors, kept out of the
+// registry
+Texture *initSpriteTexture(int width, int height)
+{
+    Texture *texture = calloc(1, sizeof(Texture));
+    texture->references = 1;
+    texture->nbLevels = 1;
+    initLevel(&texture->levels[0], width, height);
+    texture->offsets = malloc(width * height * sizeof(float));
     return texture;
 }
 
-void getPixelTexture(const Texture *texture, const Position *p, Color *c)
+// the texels whose offset is INFINITY are left transparent
+void setSpriteTexture(Texture *sprite, const Color *colors, 
+		      const float *offsets)
 {
-    Uint32 *pixel = (Uint32 *) 
-		     (texture->t->pixels +
-		      (int) (p->x * texture->t->w) * 
-		      texture->t->format->BitsPerPixel / 8 +
-		      (int) (p->y * texture->t->h) *
-		      texture->t->w *
-		      texture->t->format->BitsPerPixel / 8);
-    SDL_GetRGB(*pixel, texture->t->format, &c->r, &c->g, &c->b);
+    Level *l = &sprite->levels[0];
+    for (int h = 0; h < l->height; h++) {
+	for (int w = 0; w < l->width; w++) {
+	    int i = w + h * l->width;
+	    const Color *c = &colors[i];
+	    l->texels[getIndexLevel(l, w, h)] = offsets[i] < INFINITY ? 
+		c->r | c->g << 8 | c->b << 16 | 0xFFu << 24 : 0;
+	    sprite->offsets[i] = offsets[i];
+	}
+    }
+}
+
+int isSpriteTexture(const Texture *texture)
+{
+    return texture->offsets != NULL;
+}
+
+// p is clamped to [0, 1], 0 on a transparent texel
+int getSpriteTexture(const Texture *sprite, const Position *p, Color *c, 
+		     float *offset)
+{
+    const Level *l = &sprite->levels[0];
+    int w = p->x * l->width;
+    int h = p->y * l->height;
+    w = w < 0 ? 0 : w < l->width ? w : l->width - 1;
+    h = h < 0 ? 0 : h < l->height ? h : l->height - 1;
+    uint32_t texel = l->texels[getIndexLevel(l, w, h)];
+    if (!(texel >> 24))
+	return 0;
+    c->r = texel;
+    c->g = texel >> 8;
+    c->b = texel >> 16;
+    *offset = sprite->offsets[w + h * l->width];
+    return 1;
 }
 
 void freeTexture(Texture *texture)
 {
-    if (texture) {
-	SDL_FreeSurface(texture->t);
+    if (texture && --texture->references == 0) {
+	removeTextureFromRegistry(texture);
+	// the blocks may be reallocated to another texture
+	if (texture->compressed)
+	    memset(cache, 0, sizeof(cache));
+	free(texture->name);
+	for (int i = 0; i < texture->nbLevels; i++)
+	    free(texture->levels[i].texels);
+	free(texture->offsets);
+	freeImage(texture->image);
 	free(texture);
     }
 }
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#include "object.h"
+#include "bvh.h"
+
+#define FILENAME "test_bvh.obj"
+
+static Solid *loadString(const char *content)
+{
+    FILE *file = fopen(FILENAME, "w");
+    fputs(content, file);
+    fclose(file);
+    Solid *solid = loadObject(FILENAME, NULL);
+    remove(FILENAME);
+    return solid;
+}
+
+static void freeObject(Solid *solid)
+{
+    free(solid->vertices);
+    free(solid->packed);
+    free(solid->points);
+    free(solid->indices);
+    free(solid->lods);
+    free(solid->segments);
+    free(solid->halfEdges);
+    freeBvh(solid->bvh);
+    free(solid);
+}
+
+#define NUMBOXES 1000
+
+static float hitBox(void *data, int item, const Point *O, const Point *d)
+{
+    const Box *box = &((const Box *) data)[item];
+    float tnear = 0., tfar = INFINITY;
+    const float *o = &O->x, *u = &d->x, *low = &box->low.x;
+    const float *high = &box->high.x;
+    for (int k = 0; k < 3; k++) {
+	float t1 = (low[k] - o[k]) / u[k], t2 = (high[k] - o[k]) / u[k];
+	tnear = fmaxf(tnear, fminf(t1, t2));
+	tfar = fminf(tfar, fmaxf(t1, t2));
+    }
+    return tnear <= tfar ? tnear : INFINITY;
+}
+
+static void countBox(void *data, int item)
+{
+    ((int *) data)[item]++;
+}
+
+static void checkBvh(const Bvh *bvh, Box *boxes)
+{
+    for (int r = 0; r < 100; r++) {
+	Point O, d;
+	setPoint(&O, -60., rand() % 100, rand() % 100);
+	setPoint(&d, 1., (rand() % 100 - 50) / 100., 
+		 (rand() % 100 - 50) / 100.);
+	float best = INFINITY;
+	for (int i = 0; i < NUMBOXES; i++)
+	    best = fminf(best, hitBox(boxes, i, &O, &d));
+	int item = -1;
+	assert(rayBvh(bvh, &O, &d, hitBox, boxes, &item) == best);
+	assert(best == INFINITY || hitBox(boxes, item, &O, &d) == best);
+    }
+
+    Plane plane = {{1., 0., 0.}, -50.};
+    int *seen = calloc(NUMBOXES, sizeof(int));
+    cullBvh(bvh, &plane, 1, countBox, seen);
+    // whole leaves are visited, with their items outside the plane
+    for (int i = 0; i < NUMBOXES; i++)
+	assert(seen[i] <= 1 && (boxes[i].high.x < 50. || seen[i]));
+    free(seen);
+}
+
+void test_bvh(void)
+{
+    Box *boxes = malloc(NUMBOXES * sizeof(Box));
+    for (int i = 0; i < NUMBOXES; i++) {
+	Point A;
+	setPoint(&A, rand() % 100, rand() % 100, rand() % 100);
+	setBox(&boxes[i]);
+	growBox(&boxes[i], &A);
+	translatePoint(&A, rand() % 5 + 1, rand() % 5 + 1, rand() % 5 + 1);
+	growBox(&boxes[i], &A);
+    }
+    Bvh *bvh = buildBvh(boxes, NUMBOXES);
+    assert(bvh->numNodes < 2 * NUMBOXES);
+    checkBvh(bvh, boxes);
+
+    for (int i = 0; i < NUMBOXES; i++) {
+	translatePoint(&boxes[i].low, i % 7, 0., 3.);
+	translatePoint(&boxes[i].high, i % 7, 0., 3.);
+    }
+    refitBvh(bvh, boxes);
+    checkBvh(bvh, boxes);
+    freeBvh(bvh);
+    free(boxes);
+
+    Solid *solid = loadString("v 0 0 0\nv 1 0 0\nv 0 1 0\nv 0 0 1\n"
+			      "f 1 2 3\nf 1 2 4\nf 1 3 4\nf 2 3 4\n");
+    linkBvhBuild(solid);
+    assert(solid->bvh->nodes[0].box.low.x == 0. &&
+	   solid->bvh->nodes[0].box.high.z == 1.);
+    freeObject(solid);
+}
+
+int main(int argc, char *argv[])
+{
+    test_bvh();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "image.h"
+
+#define FILENAME "test_image.img"
+#define MAXSIZE 1024
+
+#define RED 0xFF0000FFu
+#define GREEN 0xFF00FF00u
+#define BLUE 0xFFFF0000u
+#define WHITE 0xFFFFFFFFu
+
+static Image *loadBytes(const uint8_t *bytes, size_t size)
+{
+    FILE *file = fopen(FILENAME, "wb");
+    fwrite(bytes, 1, size, file);
+    fclose(file);
+    Image *image = loadImage(FILENAME);
+    remove(FILENAME);
+    return image;
+}
+
+static void put16(uint8_t *p, uint16_t n)
+{
+    p[0] = n;
+    p[1] = n >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t n)
+{
+    put16(p, n);
+    put16(p + 2, n >> 16);
+}
+
+// top row red green blue, bottom row white black white
+static const uint32_t pixels[2][3] = {
+    {RED, GREEN, BLUE}, {WHITE, 0xFF000000u, WHITE}
+};
+
+static void assertPixels(Image *image)
+{
+    assert(image != NULL);
+    assert(getWidthImage(image) == 3 && getHeightImage(image) == 2);
+    for (int h = 0; h < 2; h++)
+	for (int w = 0; w < 3; w++)
+	    assert(getPixelImage(image, w, h) == pixels[h][w]);
+    freeImage(image);
+}
+
+// 24 bits, rows padded to 4 bytes, stored bottom-up unless height < 0
+static size_t makeBMP(uint8_t *d, int32_t height)
+{
+    memset(d, 0, MAXSIZE);
+    d[0] = 'B';
+    d[1] = 'M';
+    put32(d + 10, 54);
+    put32(d + 14, 40);
+    put32(d + 18, 3);
+    put32(d + 22, height);
+    put16(d + 26, 1);
+    put16(d + 28, 24);
+    for (int row = 0; row < 2; row++) {
+	int h = height > 0 ? 1 - row : row;
+	for (int w = 0; w < 3; w++) {
+	    uint8_t *p = d + 54 + 12 * row + 3 * w;
+	    p[0] = pixels[h][w] >> 16;
+	    p[1] = pixels[h][w] >> 8;
+	    p[2] = pixels[h][w];
+	}
+    }
+    return 54 + 2 * 12;
+}
+
+void test_bmp(void)
+{
+    uint8_t d[MAXSIZE];
+    size_t size;
+
+    assertPixels(loadBytes(d, makeBMP(d, 2)));
+    assertPixels(loadBytes(d, makeBMP(d, -2)));
+
+    size = makeBMP(d, 2);
+    assert(loadBytes(d, size - 1) == NULL);
+    assert(loadBytes(d, 40) == NULL);
+    put32(d + 30, 1); // RLE8
+    assert(loadBytes(d, size) == NULL);
+
+    makeBMP(d, 2);
+    put32(d + 18, 0);
+    assert(loadBytes(d, size) == NULL);
+    put32(d + 18, -3);
+    assert(loadBytes(d, size) == NULL);
+    put32(d + 18, 0x7FFFFFFF);
+    put32(d + 22, 0x7FFFFFFF);
+    assert(loadBytes(d, size) == NULL);
+    makeBMP(d, 2);
+    put32(d + 22, 0x80000000);
+    assert(loadBytes(d, size) == NULL);
+    makeBMP(d, 2);
+    put32(d + 10, 0xFFFFFFF0);
+    assert(loadBytes(d, size) == NULL);
+}
+
+void test_bmpIndexed(void)
+{
+    uint8_t d[MAXSIZE];
+    size_t size = makeBMP(d, -2);
+    put16(d + 28, 8);
+    put32(d + 46, 2);
+    put32(d + 10, 54 + 8);
+    put32(d + 54, 0x00FF0000); // BGRA red
+    put32(d + 58, 0x000000FF); // BGRA blue
+    memset(d + 62, 0, 8);
+    d[62 + 1] = 1;
+    d[62 + 2] = 7; // no such color
+    size = 62 + 8;
+
+    Image *image = loadBytes(d, size);
+    assert(image != NULL);
+    assert(getPixelImage(image, 0, 0) == RED);
+    assert(getPixelImage(image, 1, 0) == BLUE);
+    assert(getPixelImage(image, 2, 0) == 0xFF000000u);
+    freeImage(image);
+
+    put32(d + 14, 0xFFFFFFF0);
+    assert(loadBytes(d, size) == NULL);
+    put32(d + 14, 40);
+    put32(d + 46, 0x40000000);
+    assert(loadBytes(d, size) == NULL);
+    put32(d + 46, 2);
+    put16(d + 28, 4);
+    assert(loadBytes(d, size) == NULL);
+}
+
+// 24 bits true color, stored bottom-up unless bit 5 of the descriptor
+static size_t makeTGA(uint8_t *d, int topDown)
+{
+    memset(d, 0, MAXSIZE);
+    d[0] = 2; // skipped identification field
+    d[2] = 2;
+    put16(d + 12, 3);
+    put16(d + 14, 2);
+    d[16] = 24;
+    d[17] = topDown ? 0x20 : 0;
+    for (int row = 0; row < 2; row++) {
+	int h = topDown ? row : 1 - row;
+	for (int w = 0; w < 3; w++) {
+	    uint8_t *p = d + 20 + 9 * row + 3 * w;
+	    p[0] = pixels[h][w] >> 16;
+	    p[1] = pixels[h][w] >> 8;
+	    p[2] = pixels[h][w];
+	}
+    }
+    return 20 + 2 * 9;
+}
+
+void test_tga(void)
+{
+    uint8_t d[MAXSIZE];
+    size_t size;
+
+    assertPixels(loadBytes(d, makeTGA(d, 0)));
+    assertPixels(loadBytes(d, makeTGA(d, 1)));
+
+    size = makeTGA(d, 0);
+    assert(loadBytes(d, size - 1) == NULL);
+    assert(loadBytes(d, 17) == NULL);
+    d[2] = 10; // RLE
+    assert(loadBytes(d, size) == NULL);
+    d[2] = 1; // color mapped
+    d[1] = 1;
+    assert(loadBytes(d, size) == NULL);
+
+    makeTGA(d, 0);
+    d[16] = 16;
+    assert(loadBytes(d, size) == NULL);
+    makeTGA(d, 0);
+    put16(d + 12, 0);
+    assert(loadBytes(d, size) == NULL);
+    makeTGA(d, 0);
+    put16(d + 12, 0xFFFF);
+    put16(d + 14, 0xFFFF);
+    assert(loadBytes(d, size) == NULL);
+    makeTGA(d, 0);
+    d[0] = 0xFF;
+    assert(loadBytes(d, size) == NULL);
+
+    // grey levels
+    makeTGA(d, 1);
+    d[2] = 3;
+    d[16] = 8;
+    d[20] = 0x80;
+    Image *image = loadBytes(d, 20 + 6);
+    assert(image != NULL && getPixelImage(image, 0, 0) == 0xFF808080u);
+    freeImage(image);
+}
+
+static size_t makePPM(uint8_t *d, const char *header)
+{
+    size_t length = strlen(header);
+    memcpy(d, header, length);
+    for (int h = 0; h < 2; h++) {
+	for (int w = 0; w < 3; w++) {
+	    uint8_t *p = d + length + 9 * h + 3 * w;
+	    p[0] = pixels[h][w];
+	    p[1] = pixels[h][w] >> 8;
+	    p[2] = pixels[h][w] >> 16;
+	}
+    }
+    return length + 2 * 9;
+}
+
+void test_ppm(void)
+{
+    uint8_t d[MAXSIZE];
+    size_t size;
+
+    assertPixels(loadBytes(d, makePPM(d, "P6\n3 2\n255\n")));
+    assertPixels(loadBytes(d, makePPM(d, "P6 # comment\n3\t2 255\n")));
+
+    size = makePPM(d, "P6\n3 2\n255\n");
+    assert(loadBytes(d, size - 1) == NULL);
+    assert(loadBytes(d, 9) == NULL);
+    assert(loadBytes(d, makePPM(d, "P6\n3 2\n65535\n")) == NULL);
+    assert(loadBytes(d, makePPM(d, "P6\n0 2\n255\n")) == NULL);
+    assert(loadBytes(d, makePPM(d, "P6\n-3 2\n255\n")) == NULL);
+    assert(loadBytes(d, makePPM(d, "P6\n99999999999 2\n255\n")) == NULL);
+    assert(loadBytes(d, makePPM(d, "P6\n2000000000 2000000000\n255\n")) 
+	   == NULL);
+    assert(loadBytes(d, makePPM(d, "P3\n3 2\n255\n")) == NULL);
+
+    size = makePPM(d, "P5\n3 2\n255\n");
+    Image *image = loadBytes(d, size - 12);
+    assert(image != NULL && getPixelImage(image, 1, 1) == 0xFFFFFFFFu);
+    freeImage(image);
+}
+
+void test_empty(void)
+{
+    uint8_t d[1] = {0};
+    assert(loadBytes(d, 0) == NULL);
+    assert(loadBytes(d, 1) == NULL);
+    assert(loadImage("test_image.none") == NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    test_bmp();
+    test_bmpIndexed();
+    test_tga();
+    test_ppm();
+    test_empty();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "object.h"
+#include "cache.h"
+#include "mapping.h"
+#include "bvh.h"
+#include "lod.h"
+
+#define FILENAME "test_lod.obj"
+
+static void freeObject(Solid *solid)
+{
+    free(solid->vertices);
+    free(solid->packed);
+    free(solid->points);
+    free(solid->indices);
+    free(solid->lods);
+    free(solid->segments);
+    free(solid->halfEdges);
+    freeBvh(solid->bvh);
+    free(solid);
+}
+
+#define GRID 16
+
+void test_lod(void)
+{
+    FILE *file = fopen(FILENAME, "w");
+    for (int i = 0; i <= GRID; i++)
+	for (int j = 0; j <= GRID; j++)
+	    fprintf(file, "v %d %d 0\n", i, j);
+    for (int i = 0; i < GRID; i++) {
+	for (int j = 0; j < GRID; j++) {
+	    int A = i * (GRID + 1) + j + 1;
+	    fprintf(file, "f %d %d %d\nf %d %d %d\n", A, A + GRID + 1, 
+		    A + 1, A + 1, A + GRID + 1, A + GRID + 2);
+	}
+    }
+    fclose(file);
+    Solid *solid = loadObject(FILENAME, NULL);
+    int numFaces = solid->numFaces;
+    simplifyLod(solid);
+    assert(solid->numLods > 1 && solid->numFaces == numFaces);
+
+    // each level halves the faces, uses a prefix of the vertices and
+    // keeps the plane and its borders
+    for (int k = 0; k < solid->numLods; k++) {
+	const Lod *lod = &solid->lods[k];
+	assert(k == 0 || (lod->numFaces <= solid->lods[k - 1].numFaces / 2 &&
+			  lod->firstFace == solid->lods[k - 1].firstFace + 
+			  solid->lods[k - 1].numFaces &&
+			  lod->numVertices <= solid->lods[k - 1].numVertices));
+	assert(lod->error < 0.001);
+	// the vertices the level adds come in the order its faces use them
+	int next = k + 1 < solid->numLods ? 
+	    solid->lods[k + 1].numVertices : 0;
+	Box box;
+	setBox(&box);
+	for (int i = 3 * lod->firstFace; 
+	     i < 3 * (lod->firstFace + lod->numFaces); i++) {
+	    int v = getIndexBuild(solid, i);
+	    assert(v < lod->numVertices && v <= next);
+	    if (v == next)
+		next++;
+	    growBox(&box, &solid->vertices[v].point);
+	}
+	assert(next == lod->numVertices);
+	assert(box.low.y == 0. && box.low.z == 0. && 
+	       box.high.y == GRID && box.high.z == GRID);
+    }
+
+    saveCache(FILENAME, solid);
+    Solid *cached = loadCache(FILENAME, NULL);
+    assert(cached && cached->numLods == solid->numLods &&
+	   cached->numFaces == numFaces);
+    assert(!memcmp(cached->lods, solid->lods, 
+		   solid->numLods * sizeof(Lod)));
+    unmapFile(cached->mapping, cached->mappingSize);
+    free(cached);
+    remove(FILENAME);
+    remove(FILENAME ".cache");
+    freeObject(solid);
+}
+
+int main(int argc, char *argv[])
+{
+    test_lod();
+    return EXIT_SUCCESS;
+}
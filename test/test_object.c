@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "object.h"
+#include "cache.h"
+#include "mapping.h"
+#include "bvh.h"
+
+#define FILENAME "test_object.obj"
+
+static Solid *loadString(const char *content)
+{
+    FILE *file = fopen(FILENAME, "w");
+    fputs(content, file);
+    fclose(file);
+    Solid *solid = loadObject(FILENAME, NULL);
+    remove(FILENAME);
+    return solid;
+}
+
+static void freeObject(Solid *solid)
+{
+    free(solid->vertices);
+    free(solid->packed);
+    free(solid->points);
+    free(solid->indices);
+    free(solid->lods);
+    free(solid->segments);
+    free(solid->halfEdges);
+    freeBvh(solid->bvh);
+    free(solid);
+}
+
+static const Vertex *getVertex(const Solid *solid, int f, int k)
+{
+    return &solid->vertices[getIndexBuild(solid, 3 * f + k)];
+}
+
+static int getPoint(const Solid *solid, int f, int k)
+{
+    return solid->points[getIndexBuild(solid, 3 * f + k)];
+}
+
+// faces are reordered at load, they are found by their points
+static int findFace(const Solid *solid, int A, int B, int C)
+{
+    for (int f = 0; f < solid->numFaces; f++)
+	if (getPoint(solid, f, 0) == A && getPoint(solid, f, 1) == B &&
+	    getPoint(solid, f, 2) == C)
+	    return f;
+    return -1;
+}
+
+void test_floats(void)
+{
+    Solid *solid = loadString("v 1.5e2 -0.25 +3\r\n"
+			      "v 0 1 0 # comment\n"
+			      "v .5 0 1\n"
+			      "f 1 2 3\n");
+    assert(solid && solid->numVertices == 3);
+    // y, z and x are stored in this order in the file
+    assert(solid->vertices[0].point.y == 150. && 
+	   solid->vertices[0].point.z == -0.25 &&
+	   solid->vertices[0].point.x == 3.);
+    assert(solid->vertices[2].point.y == 0.5);
+    freeObject(solid);
+}
+
+void test_faces(void)
+{
+    Solid *solid = loadString("v 0 0 0\nv 1 0 0\nv 0 1 0\nv 0 0 1\n"
+			      "v 1 1 1\nvt 0 0\nvt 1 1\nvn 0 0 1\n"
+			      "f 1 2 3\n"
+			      "f 1/1 2/2 4/1\n"
+			      "f 1//1 3//1 4//1\n"
+			      "f -5/-2/-1 -3/-1/-1 -1/-2/-1\n"
+			      "f 2/1/1 3/1/1 4/1/1 5/1/1\n");
+    assert(solid && solid->numFaces == 6);
+
+    int f = findFace(solid, 0, 2, 4);
+    assert(f >= 0);
+    assert(getVertex(solid, f, 0)->coord.y == 1. && 
+	   getVertex(solid, f, 1)->coord.x == 1.);
+    assert(getVertex(solid, f, 2)->normal.x == 1.);
+
+    // a default coord and a normal per face are used when missing
+    f = findFace(solid, 0, 1, 2);
+    assert(f >= 0 && getVertex(solid, f, 0)->coord.x == 0. && 
+	   getVertex(solid, f, 0)->coord.y == 0.);
+    assert(getVertex(solid, f, 2)->normal.x == 1.);
+    f = findFace(solid, 0, 1, 3);
+    assert(f >= 0 && getVertex(solid, f, 0)->normal.z != 0.);
+
+    // polygons are split in fans, identical corners are welded
+    f = findFace(solid, 1, 2, 3);
+    int g = findFace(solid, 1, 3, 4);
+    assert(f >= 0 && g >= 0);
+    assert(getVertex(solid, f, 0) == getVertex(solid, g, 0));
+    assert(getVertex(solid, f, 1) != 
+	   getVertex(solid, findFace(solid, 0, 2, 3), 1));
+    assert(solid->numVertices == 15 && solid->indexSize == 2);
+
+    assert(solid->segments == NULL);
+    extractSegmentBuild(solid);
+    assert(solid->numSegments == 10);
+    freeObject(solid);
+}
+
+void test_halfEdges(void)
+{
+    Solid *solid = loadString("v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n"
+			      "v 0 0 1\nv 1 0 1\nv 1 1 1\nv 0 1 1\n"
+			      "f 1 4 3 2\nf 5 6 7 8\nf 1 2 6 5\n"
+			      "f 2 3 7 6\nf 3 4 8 7\nf 4 1 5 8\n");
+    assert(solid && solid->numFaces == 12);
+    linkHalfEdgeBuild(solid);
+
+    // a closed cube: every half-edge has a twin, the diagonals are flat
+    int creases = 0;
+    for (int h = 0; h < 3 * solid->numFaces; h++) {
+	int twin = solid->halfEdges[h].twin;
+	assert(twin >= 0 && solid->halfEdges[twin].twin == h);
+	assert(solid->halfEdges[twin].crease == solid->halfEdges[h].crease);
+	creases += solid->halfEdges[h].crease;
+    }
+    assert(creases == 2 * 12);
+    freeObject(solid);
+
+    // three faces on one edge: one pair of twins, the third is a border
+    solid = loadString("v 0 0 0\nv 1 0 0\nv 0 1 0\nv 0 -1 0\nv 0 0 1\n"
+		       "f 1 2 3\nf 2 1 4\nf 2 1 5\n");
+    linkHalfEdgeBuild(solid);
+    int twins = 0;
+    for (int h = 0; h < 3 * solid->numFaces; h++) {
+	int twin = solid->halfEdges[h].twin;
+	assert(twin == -1 || solid->halfEdges[twin].twin == h);
+	twins += twin != -1;
+    }
+    assert(twins == 2);
+    freeObject(solid);
+}
+
+void test_errors(void)
+{
+    assert(loadString("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n") == NULL);
+    assert(loadString("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 -4\n") == NULL);
+    assert(loadString("v 0 0 0\nv 1 0 0\nf 1 2\n") == NULL);
+    assert(loadString("v 0 zero 0\n") == NULL);
+}
+
+// large enough to be split in several chunks parsed separately
+void test_chunks(void)
+{
+    const int nbFaces = 200000;
+    FILE *file = fopen(FILENAME, "w");
+    for (int i = 0; i < nbFaces; i++) {
+	fprintf(file, "v %d 0 0\nv %d 1 0\nv %d 0 1\n", i, i, i);
+	fprintf(file, "f -3 -2 -1\n");
+    }
+    fclose(file);
+    Solid *solid = loadObject(FILENAME, NULL);
+    remove(FILENAME);
+
+    assert(solid && solid->numFaces == nbFaces);
+    char *seen = calloc(nbFaces, 1);
+    for (int f = 0; f < nbFaces; f++) {
+	int i = getPoint(solid, f, 0) / 3;
+	assert(getPoint(solid, f, 0) == 3 * i && 
+	       getPoint(solid, f, 2) == 3 * i + 2 && !seen[i]);
+	assert(getVertex(solid, f, 1)->point.y == i);
+	seen[i] = 1;
+    }
+    free(seen);
+    freeObject(solid);
+}
+
+#define GRID 32
+
+// the faces of a grid in a random order, reordered at load for the cache
+// of transformed vertices
+void test_missRatio(void)
+{
+    int numFaces = 2 * GRID * GRID;
+    int (*faces)[3] = malloc(numFaces * sizeof(*faces));
+    for (int i = 0; i < GRID; i++) {
+	for (int j = 0; j < GRID; j++) {
+	    int A = i * (GRID + 1) + j;
+	    int *f = faces[2 * (i * GRID + j)];
+	    f[0] = A, f[1] = A + GRID + 1, f[2] = A + 1;
+	    f[3] = A + 1, f[4] = A + GRID + 1, f[5] = A + GRID + 2;
+	}
+    }
+    for (int f = numFaces - 1; f > 0; f--) {
+	int g = rand() % (f + 1);
+	for (int k = 0; k < 3; k++) {
+	    int tmp = faces[f][k];
+	    faces[f][k] = faces[g][k];
+	    faces[g][k] = tmp;
+	}
+    }
+    FILE *file = fopen(FILENAME, "w");
+    fputs("vn 0 0 1\n", file);
+    for (int i = 0; i <= GRID; i++)
+	for (int j = 0; j <= GRID; j++)
+	    fprintf(file, "v %d %d 0\n", i, j);
+    for (int f = 0; f < numFaces; f++)
+	fprintf(file, "f %d//1 %d//1 %d//1\n", faces[f][0] + 1, 
+		faces[f][1] + 1, faces[f][2] + 1);
+    fclose(file);
+    Solid *solid = loadObject(FILENAME, NULL);
+    remove(FILENAME);
+    assert(solid && solid->numFaces == numFaces);
+
+    // the same faces in the order of the file
+    Solid original = *solid;
+    uint32_t *indices = malloc(3 * numFaces * sizeof(uint32_t));
+    for (int f = 0; f < numFaces; f++) {
+	int g = findFace(solid, faces[f][0], faces[f][1], faces[f][2]);
+	assert(g >= 0);
+	for (int k = 0; k < 3; k++)
+	    indices[3 * f + k] = getIndexBuild(solid, 3 * g + k);
+    }
+    original.indices = indices;
+    original.indexSize = sizeof(uint32_t);
+    float ratio = getMissRatioBuild(solid);
+    assert(ratio < getMissRatioBuild(&original) / 2);
+    free(indices);
+    free(faces);
+    freeObject(solid);
+}
+
+void test_cache(void)
+{
+    FILE *file = fopen(FILENAME, "w");
+    fputs("v 0 0 0\nv 1 0 0\nv 0 1 0\nv 0 0 1\nvt 0.5 1\n"
+	  "f 1 2 3 4\nf 1/1 3/1 4/1\n", file);
+    fclose(file);
+    Solid *solid = loadObject(FILENAME, NULL);
+    assert(solid && loadCache(FILENAME, NULL) == NULL);
+    saveCache(FILENAME, solid);
+
+    Solid *cached = loadCache(FILENAME, NULL);
+    assert(cached && cached->mapping);
+    assert(cached->numVertices == solid->numVertices &&
+	   cached->numFaces == solid->numFaces &&
+	   cached->indexSize == solid->indexSize);
+    assert(!memcmp(cached->vertices, solid->vertices, 
+		   solid->numVertices * sizeof(Vertex)));
+    assert(!memcmp(cached->points, solid->points, 
+		   solid->numVertices * sizeof(int)));
+    assert(!memcmp(cached->indices, solid->indices, 
+		   3 * solid->numFaces * solid->indexSize));
+
+    // saving again replaces the file, the mapped one stays readable
+    saveCache(FILENAME, solid);
+    assert(!memcmp(cached->vertices, solid->vertices, 
+		   solid->numVertices * sizeof(Vertex)));
+    unmapFile(cached->mapping, cached->mappingSize);
+    free(cached);
+
+    // an index beyond the vertices makes the cache invalid
+    size_t size = 3 * solid->numFaces * solid->indexSize;
+    file = fopen(FILENAME ".cache", "r+");
+    char data[4096];
+    size_t length = fread(data, 1, sizeof(data), file);
+    size_t offset = 0;
+    while (offset + size <= length && 
+	   memcmp(&data[offset], solid->indices, size) != 0)
+	offset++;
+    assert(offset + size <= length);
+    memset(&data[offset], 0xFF, solid->indexSize);
+    fseek(file, offset, SEEK_SET);
+    fwrite(&data[offset], solid->indexSize, 1, file);
+    fclose(file);
+    assert(loadCache(FILENAME, NULL) == NULL);
+
+    // a modified source invalidates the cache
+    file = fopen(FILENAME, "a");
+    fputs("v 1 1 1\n", file);
+    fclose(file);
+    assert(loadCache(FILENAME, NULL) == NULL);
+
+    remove(FILENAME);
+    remove(FILENAME ".cache");
+    freeObject(solid);
+}
+
+void test_packed(void)
+{
+    Solid *solid = loadString("v -2 0 0.3\nv 1 5 0\nv 0 1 -7\n"
+			      "vt 0.25 0\nvt 1 0.5\nvn 0.6 0 -0.8\n"
+			      "vn 0 0 1\nvn -0.36 -0.48 -0.8\n"
+			      "f 1/1/1 2/2/2 3/1/3\n");
+    int n = solid->numVertices;
+    Vertex *vertices = malloc(n * sizeof(Vertex));
+    memcpy(vertices, solid->vertices, n * sizeof(Vertex));
+    packBuild(solid);
+    assert(solid->packed && solid->vertices == NULL);
+
+    for (int i = 0; i < n; i++) {
+	Vertex v;
+	getVertexBuild(solid, i, &v);
+	assert(fabsf(v.point.x - vertices[i].point.x) <= solid->step.x);
+	assert(fabsf(v.point.y - vertices[i].point.y) <= solid->step.y);
+	assert(fabsf(v.point.z - vertices[i].point.z) <= solid->step.z);
+	assert(fabsf(v.coord.x - vertices[i].coord.x) <=
+	       solid->coordStep.x);
+	assert(fabsf(v.coord.y - vertices[i].coord.y) <=
+	       solid->coordStep.y);
+	assert(scalarProduct(&v.normal, &vertices[i].normal) > 0.99999);
+    }
+    free(vertices);
+    freeObject(solid);
+}
+
+int main(int argc, char *argv[])
+{
+    test_floats();
+    test_faces();
+    test_halfEdges();
+    test_errors();
+    test_chunks();
+    test_missRatio();
+    test_cache();
+    test_packed();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,48 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "occlusion.h"
+
+void test_occlusion(void)
+{
+    Occlusion *o = initOcclusion();
+    resetOcclusion(o, 100, 60);
+    Coord A, B, C, D, low, high;
+    setCoord(&A, 0, 0);
+    setCoord(&B, 0, 59);
+    setCoord(&C, 99, 0);
+    setCoord(&D, 99, 59);
+    // two front faces cover the screen together, a back face does not
+    occludeTriangle(o, &A, 10., &C, 10., &B, 10.);
+    setCoord(&low, 10, 10);
+    setCoord(&high, 20, 20);
+    assert(!isOccludedRect(o, &low, &high, 20.));
+    occludeTriangle(o, &A, 10., &B, 10., &C, 10.);
+    occludeTriangle(o, &B, 10., &D, 10., &C, 12.);
+    assert(isOccludedRect(o, &low, &high, 20.));
+    assert(!isOccludedRect(o, &low, &high, 9.));
+    // the farthest depth of a tile is kept, near C
+    setCoord(&low, 90, -10);
+    setCoord(&high, 150, 5);
+    assert(isOccludedRect(o, &low, &high, 12.5));
+    assert(!isOccludedRect(o, &low, &high, 11.));
+
+    // a corner left uncovered keeps what is behind it
+    resetOcclusion(o, 100, 60);
+    setCoord(&D, 99, 40);
+    occludeTriangle(o, &A, 10., &B, 10., &C, 10.);
+    occludeTriangle(o, &B, 10., &D, 10., &C, 10.);
+    setCoord(&low, 95, 55);
+    setCoord(&high, 99, 59);
+    assert(!isOccludedRect(o, &low, &high, 20.));
+    setCoord(&low, 0, 0);
+    setCoord(&high, 40, 40);
+    assert(isOccludedRect(o, &low, &high, 20.));
+    freeOcclusion(o);
+}
+
+int main(int argc, char *argv[])
+{
+    test_occlusion();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "parametric.h"
+
+#define EQNAME "test_parametric.eq"
+#define MAXLENGTH 256
+#define MAXPOINTS 40000
+
+static float *min, *max;
+static int *precision, nbInput, nbOutput;
+
+static int loadEquationFile(const char *fileName)
+{
+    return initEquation(&min, &max, &precision, &nbInput, &nbOutput,
+			fileName);
+}
+
+static int loadString(const char *content)
+{
+    FILE *file = fopen(EQNAME, "w");
+    fputs(content, file);
+    fclose(file);
+    int ok = loadEquationFile(EQNAME);
+    remove(EQNAME);
+    return ok;
+}
+
+static void freeString(void)
+{
+    freeEquation();
+    free(min);
+    free(max);
+    free(precision);
+}
+
+static int isClose(float a, float b)
+{
+    return fabsf(a - b) <= 1e-6 * fmaxf(1., fabsf(b));
+}
+
+// the points of the grid of the equation, evaluated one at a time, in
+// batches and through the tables of the grid, give the same outputs
+static void checkGrid(void)
+{
+    float interval[nbInput + 1];
+    int lengths[nbInput + 1];
+    int n = 1;
+    for (int i = 0; i < nbInput; i++) {
+	lengths[i] = precision[i];
+	interval[i] = (max[i] - min[i]) / (precision[i] - 1);
+	n *= lengths[i];
+    }
+    assert(n <= MAXPOINTS);
+
+    float *inputs[nbInput + 1], *outputs[nbOutput + 1];
+    float *gridOutputs[nbOutput + 1];
+    int *grids[nbInput + 1];
+    for (int i = 0; i < nbInput; i++) {
+	inputs[i] = malloc(n * sizeof(float));
+	grids[i] = malloc(n * sizeof(int));
+    }
+    for (int i = 0; i < nbOutput; i++) {
+	outputs[i] = malloc(n * sizeof(float));
+	gridOutputs[i] = malloc(n * sizeof(float));
+    }
+    for (int k = 0; k < n; k++) {
+	for (int i = 0, r = k; i < nbInput; r /= lengths[i++]) {
+	    grids[i][k] = r % lengths[i];
+	    inputs[i][k] = grids[i][k] ?
+		min[i] + interval[i] * grids[i][k] : min[i];
+	}
+    }
+
+    initGridEquation(min, interval, lengths);
+    getGridValuesFromEquation(grids, gridOutputs, n);
+    getValuesFromEquation(inputs, outputs, n);
+    for (int k = 0; k < n; k++) {
+	float input[nbInput + 1], output[nbOutput + 1];
+	for (int i = 0; i < nbInput; i++)
+	    input[i] = inputs[i][k];
+	getValueFromEquation(input, output);
+	for (int i = 0; i < nbOutput; i++)
+	    assert(isClose(outputs[i][k], output[i]) &&
+		   isClose(gridOutputs[i][k], output[i]));
+    }
+
+    for (int i = 0; i < nbInput; i++) {
+	free(inputs[i]);
+	free(grids[i]);
+    }
+    for (int i = 0; i < nbOutput; i++) {
+	free(outputs[i]);
+	free(gridOutputs[i]);
+    }
+}
+
+void test_models(void)
+{
+    DIR *directory = opendir(MODELS);
+    assert(directory);
+    struct dirent *entry;
+    int count = 0;
+    while ((entry = readdir(directory)) != NULL) {
+	char fileName[sizeof(MODELS) + MAXLENGTH];
+	size_t length = strlen(entry->d_name);
+	if (length < 3 || strcmp(&entry->d_name[length - 3], ".eq") != 0)
+	    continue;
+	sprintf(fileName, "%s/%s", MODELS, entry->d_name);
+	assert(loadEquationFile(fileName));
+	checkGrid();
+	freeString();
+	count++;
+    }
+    closedir(directory);
+    assert(count > 0);
+}
+
+void test_errors(void)
+{
+    // nothing is left to free
+    assert(!loadString("input 0 1 2\noutput foo($0)\n"));
+    assert(!min && !max && !precision);
+    freeString();
+    assert(!loadString("input 0 1 2\noutput ($1+1)\n"));
+    freeString();
+    assert(!loadString("input 0 1 2\noutput ($0+1))\n"));
+    freeString();
+    assert(!loadString("input 0 1 2\noutput ($0+1\n"));
+    freeString();
+    assert(!loadString("input 0 1 2\noutput )\n"));
+    freeString();
+}
+
+void test_folding(void)
+{
+    // the constants are computed at load, a division by zero gives zero
+    float input[2] = {3., 0.}, output[3];
+    assert(loadString("input 0 1 2\n"
+		      "output ((1+2)*$0)\n"
+		      "output (1/(2-2))\n"
+		      "output ($0/(2-2))\n"));
+    assert(getSizeEquation() == 5);
+    getValueFromEquation(input, output);
+    assert(output[0] == 9. && output[1] == 0. && output[2] == 0.);
+    checkGrid();
+    freeString();
+}
+
+void test_sharing(void)
+{
+    // the subterms found again, in any order of the operands of + and *,
+    // are computed once
+    float input[3] = {0.5, 2., 0.}, output[3];
+    assert(loadString("input 0 1 3\ninput 1 2 3\n"
+		      "output (sin($0)*($1+1))\n"
+		      "output ((1+$1)*sin($0))\n"
+		      "output (sqrt(($1+1))+sin($0))\n"));
+    assert(getSizeEquation() == 8);
+    getValueFromEquation(input, output);
+    assert(output[0] == output[1]);
+    assert(isClose(output[2], sqrt(3.) + sin(0.5)));
+    checkGrid();
+    freeString();
+}
+
+// the batch evaluator against libm, from small arguments to the largest
+// floats, subnormals and the special values
+void test_libm(void)
+{
+    float special[] = {
+	0., -0., 1e-40, -1e-40, 1.17549435e-38, 3e38, -3e38, 
+	INFINITY, -INFINITY, NAN, -1.
+    };
+    int numSpecial = sizeof(special) / sizeof(special[0]);
+    int n = numSpecial + 64 * 16;
+    float *inputs[1], *outputs[3];
+    inputs[0] = malloc(n * sizeof(float));
+    for (int i = 0; i < 3; i++)
+	outputs[i] = malloc(n * sizeof(float));
+    memcpy(inputs[0], special, sizeof(special));
+    for (int k = numSpecial; k < n; k++)
+	inputs[0][k] = ldexpf((rand() % 2 ? 1. : -1.) * rand() / RAND_MAX, 
+			      (k - numSpecial) / 16 * 2 - 2);
+
+    assert(loadString("input 0 1 2\n"
+		      "output sin($0)\noutput cos($0)\noutput sqrt($0)\n"));
+    getValuesFromEquation(inputs, outputs, n);
+    for (int k = 0; k < n; k++) {
+	double x = inputs[0][k];
+	double expected[3] = {sin(x), cos(x), sqrt(x)};
+	for (int i = 0; i < 3; i++)
+	    assert(isnan(expected[i]) ? isnan(outputs[i][k]) :
+		   outputs[i][k] == expected[i] ||
+		   fabs(outputs[i][k] - expected[i]) <= 
+		   2e-7 * fmax(1., fabs(expected[i])));
+    }
+    freeString();
+    free(inputs[0]);
+    for (int i = 0; i < 3; i++)
+	free(outputs[i]);
+}
+
+int main(int argc, char *argv[])
+{
+    // the native libraries are built in a cache of the test
+    char cache[MAXLENGTH];
+    assert(getcwd(cache, MAXLENGTH - 32));
+    strcat(cache, "/test_parametric.cache");
+    setenv("XDG_CACHE_HOME", cache, 1);
+
+    // the interpreter, then the native code when a compiler is found
+    char *cc = getenv("CC") ? strdup(getenv("CC")) : NULL;
+    setenv("CC", "/nonexistent/cc", 1);
+    for (int pass = 0; pass < 2; pass++) {
+	test_models();
+	test_errors();
+	test_folding();
+	test_sharing();
+	test_libm();
+	if (cc != NULL)
+	    setenv("CC", cc, 1);
+	else
+	    unsetenv("CC");
+    }
+    free(cc);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,39 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#include "texture.h"
+
+void test_sprite(void)
+{
+    Texture *sprite = initSpriteTexture(2, 2);
+    Color colors[4];
+    float offsets[4] = {-1., INFINITY, 0.5, 2.};
+    for (int i = 0; i < 4; i++) {
+	colors[i].r = 10 * i;
+	colors[i].g = 20 * i;
+	colors[i].b = 30 * i;
+    }
+    setSpriteTexture(sprite, colors, offsets);
+    assert(isSpriteTexture(sprite));
+
+    // the empty texel is transparent, the others keep their depth
+    Position p;
+    Color c;
+    float offset;
+    setPosition(&p, 0.75, 0.25);
+    assert(!getSpriteTexture(sprite, &p, &c, &offset));
+    setPosition(&p, 0.25, 0.75);
+    assert(getSpriteTexture(sprite, &p, &c, &offset));
+    assert(c.r == 20 && c.g == 40 && c.b == 60 && offset == 0.5);
+    // positions out of the sprite are clamped
+    setPosition(&p, 1.5, 1.);
+    assert(getSpriteTexture(sprite, &p, &c, &offset) && offset == 2.);
+    freeTexture(sprite);
+}
+
+int main(int argc, char *argv[])
+{
+    test_sprite();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#include "texture.h"
+
+#define SIZE 64
+#define RAWNAME "test_texture_raw.ppm"
+#define BC1NAME "test_texture_bc1.ppm"
+
+typedef unsigned char Pixel[3];
+
+static void writePPM(const char *fileName, Pixel *pixels, int width, 
+		     int height)
+{
+    FILE *file = fopen(fileName, "wb");
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    fwrite(pixels, sizeof(Pixel), width * height, file);
+    fclose(file);
+}
+
+static Texture *loadPixels(const char *fileName, Pixel *pixels, 
+			   int width, int height, int compressed)
+{
+    writePPM(fileName, pixels, width, height);
+    setCompressionTexture(compressed);
+    Texture *texture = loadTexture(fileName);
+    remove(fileName);
+    assert(texture != NULL);
+    assert(getLevelTexture(texture, 0., 0., 0., 0.) == 0);
+    return texture;
+}
+
+static void getTexel(const Texture *texture, int w, int h, Color *c)
+{
+    Position p;
+    setPosition(&p, (w + 0.5) / SIZE, (h + 0.5) / SIZE);
+    getPixelTexture(texture, 0, &p, c);
+}
+
+static int getError(const Color *c, const unsigned char *pixel)
+{
+    int e[3] = {c->r - pixel[0], c->g - pixel[1], c->b - pixel[2]};
+    int max = 0;
+    for (int k = 0; k < 3; k++)
+	max = abs(e[k]) > max ? abs(e[k]) : max;
+    return max;
+}
+
+// a smooth gradient, flat tiles and two colors tiles
+static void fillPixels(Pixel *pixels)
+{
+    for (int h = 0; h < SIZE; h++) {
+	for (int w = 0; w < SIZE; w++) {
+	    unsigned char *p = pixels[h * SIZE + w];
+	    if (h < SIZE / 2) {
+		p[0] = 4 * w;
+		p[1] = 8 * h;
+		p[2] = 255 - 2 * (w + h);
+	    } else if (w < SIZE / 2) {
+		p[0] = 40 * (w / 4 % 6);
+		p[1] = 30 * (h / 4 % 8);
+		p[2] = 200;
+	    } else {
+		int on = (w + h) % 2;
+		p[0] = on ? 248 : 0;
+		p[1] = on ? 252 : 0;
+		p[2] = on ? 248 : 0;
+	    }
+	}
+    }
+}
+
+void test_uncompressed(void)
+{
+    Pixel *pixels = malloc(SIZE * SIZE * sizeof(Pixel));
+    fillPixels(pixels);
+    Texture *texture = loadPixels(RAWNAME, pixels, SIZE, SIZE, 0);
+    for (int h = 0; h < SIZE; h++) {
+	for (int w = 0; w < SIZE; w++) {
+	    Color c;
+	    getTexel(texture, w, h, &c);
+	    assert(getError(&c, pixels[h * SIZE + w]) == 0);
+	}
+    }
+    freeTexture(texture);
+    free(pixels);
+}
+
+// the end points are stored in RGB565: flat tiles are off by at most 7 on
+// red and blue, 3 on green; the gradient and the two colors tiles are
+// bounded by the spacing of the palette, the whole image by an RMS error
+// of 10
+void test_roundTrip(void)
+{
+    Pixel *pixels = malloc(SIZE * SIZE * sizeof(Pixel));
+    fillPixels(pixels);
+    Texture *texture = loadPixels(BC1NAME, pixels, SIZE, SIZE, 1);
+    double sum = 0.;
+    for (int h = 0; h < SIZE; h++) {
+	for (int w = 0; w < SIZE; w++) {
+	    Color c;
+	    const unsigned char *p = pixels[h * SIZE + w];
+	    getTexel(texture, w, h, &c);
+	    int e = getError(&c, p);
+	    sum += e * e;
+	    if (h >= SIZE / 2 && w < SIZE / 2) {
+		assert(abs(p[0] - c.r) <= 7 && abs(p[2] - c.b) <= 7);
+		assert(abs(p[1] - c.g) <= 3);
+	    } else {
+		assert(e <= 16);
+	    }
+	}
+    }
+    assert(sqrt(sum / (SIZE * SIZE)) < 10.);
+    freeTexture(texture);
+    free(pixels);
+}
+
+// the decoded blocks are kept in a small cache indexed by address:
+// sampling in any order, alternating with another texture whose blocks
+// collide with these ones, must give the same texels
+void test_blockCache(void)
+{
+    Pixel *pixels = malloc(SIZE * SIZE * sizeof(Pixel));
+    Pixel *other = malloc(SIZE * SIZE * sizeof(Pixel));
+    Color *first = malloc(SIZE * SIZE * sizeof(Color));
+    fillPixels(pixels);
+    for (int i = 0; i < SIZE * SIZE; i++)
+	for (int k = 0; k < 3; k++)
+	    other[i][k] = 255 - pixels[i][k];
+
+    Texture *texture = loadPixels(BC1NAME, pixels, SIZE, SIZE, 1);
+    Texture *inverse = loadPixels(RAWNAME, other, SIZE, SIZE, 1);
+    for (int i = 0; i < SIZE * SIZE; i++)
+	getTexel(texture, i % SIZE, i / SIZE, &first[i]);
+
+    for (int k = 0; k < SIZE * SIZE; k++) {
+	int i = k * 1031 % (SIZE * SIZE);
+	Color c, d;
+	getTexel(inverse, i % SIZE, i / SIZE, &d);
+	getTexel(texture, i % SIZE, i / SIZE, &c);
+	assert(c.r == first[i].r && c.g == first[i].g && c.b == first[i].b);
+	getTexel(inverse, i % SIZE, i / SIZE, &c);
+	assert(c.r == d.r && c.g == d.g && c.b == d.b);
+	assert(abs(c.r + first[i].r - 255) <= 16);
+    }
+    freeTexture(inverse);
+    freeTexture(texture);
+    free(first);
+    free(other);
+    free(pixels);
+}
+
+int main(int argc, char *argv[])
+{
+    test_uncompressed();
+    test_roundTrip();
+    test_blockCache();
+    return EXIT_SUCCESS;
+}